@@ -210,14 +210,38 @@ void setup()
   // selectHyper(), selectStandard(), or selectTurtle().
   selectEdition();
 
-  // Wait for button B to be pressed and released.
-  display.clear();
-  display.print(F("Press B"));
-  display.gotoXY(0, 1);
-  display.print(F("to calib"));
-  while(!buttonB.getSingleDebouncedPress());
+  if (lineSensors.loadCalibration())
+  {
+    // A calibration from an earlier run was found in EEPROM.  Press
+    // A to use it and skip the calibration sweep, or B to
+    // calibrate again.
+    display.clear();
+    display.print(F("A: saved"));
+    display.gotoXY(0, 1);
+    display.print(F("B: calib"));
+    while(true)
+    {
+      if (buttonA.getSingleDebouncedPress()) { break; }
+      if (buttonB.getSingleDebouncedPress())
+      {
+        calibrateSensors();
+        lineSensors.saveCalibration();
+        break;
+      }
+    }
+  }
+  else
+  {
+    // Wait for button B to be pressed and released.
+    display.clear();
+    display.print(F("Press B"));
+    display.gotoXY(0, 1);
+    display.print(F("to calib"));
+    while(!buttonB.getSingleDebouncedPress());
 
-  calibrateSensors();
+    calibrateSensors();
+    lineSensors.saveCalibration();
+  }
 
   showReadings();
 
@@ -85,6 +85,10 @@ void selectEdition()
   display.print("OK!  ...");
 }
 
+// Sample the bump sensors every 2 ms and report a contact as soon as one
+// sample sees it, so the robot reacts within a few milliseconds.
+const uint16_t bumpPeriod = 2000;
+
 void setup()
 {
   // To bypass the menu, replace this function with
@@ -92,16 +96,16 @@ void setup()
   selectEdition();
 
   bumpSensors.calibrate();
+  bumpSensors.debounceSamples = 1;
+  bumpSensors.startBackgroundSampling(bumpPeriod);
   delay(1000);
   display.clear();
 }
 
-void loop()
+// Backs away from a contact on the given side by turning in place.
+void turnAway(uint8_t side)
 {
-  motors.setSpeeds(maxSpeed, maxSpeed);
-  bumpSensors.read();
-
-  if (bumpSensors.leftIsPressed())
+  if (side == BumpLeft)
   {
     // Left bump sensor is pressed.
     ledYellow(true);
@@ -119,7 +123,7 @@ void loop()
     display.gotoXY(0, 0);
     display.print(' ');
   }
-  else if (bumpSensors.rightIsPressed())
+  else
   {
     // Right bump sensor is pressed.
     ledRed(true);
@@ -138,3 +142,33 @@ void loop()
     display.print(' ');
   }
 }
+
+// Throws away any events that are waiting in the queue.
+void discardBumpEvents()
+{
+  BumpEvent event;
+  while (bumpSensors.getEvent(event));
+}
+
+void loop()
+{
+  motors.setSpeeds(maxSpeed, maxSpeed);
+
+  // The bump sensors are sampled in the background, which adds an event
+  // to a queue whenever a bump sensor is pressed or released.  Checking the
+  // queue here does not have to wait for a reading.
+  BumpEvent event;
+  if (!bumpSensors.getEvent(event) || !event.pressed) { return; }
+
+  turnAway(event.side);
+
+  // The events that came in while turning are out of date, so discard
+  // them, and keep turning for as long as a bumper is still pressed.
+  discardBumpEvents();
+  uint8_t bumps;
+  while ((bumps = bumpSensors.getBackgroundState()) != 0)
+  {
+    turnAway((bumps & (1 << BumpLeft)) ? BumpLeft : BumpRight);
+    discardBumpEvents();
+  }
+}
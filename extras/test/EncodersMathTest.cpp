@@ -0,0 +1,111 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+// Checks the wheel speed estimator used by Encoders against a simulated
+// encoder turning at a constant speed, including starting from a stop.
+
+#include <Pololu3piPlus32U4EncodersMath.h>
+#include <stdio.h>
+
+using namespace Pololu3piPlus32U4;
+
+static unsigned failures = 0;
+
+// A wheel that has been stopped for stopTime microseconds and then turns at
+// speed counts per second.  Each edge records the timer ticks like the
+// encoder ISRs do, and the estimator is called every period microseconds
+// (plus the 4 us jitter of micros()) like a control loop would.
+static void testRestart(uint32_t speed, uint32_t period, uint32_t stopTime,
+  bool fromReset)
+{
+  EncodersMath::SpeedState state;
+  uint16_t count = 0;
+  uint16_t edgeTicks = 0;
+  uint32_t start = 1000000;  // when the wheel starts turning
+  uint32_t edgeInterval = 1000000 / speed;
+  uint32_t nextEdge = start + edgeInterval;
+
+  uint32_t now = start - stopTime - 10000;
+  EncodersMath::resetSpeed(state, count, now);
+  if (!fromReset)
+  {
+    // Let the estimator see the wheel turning and then stopping.
+    for (uint16_t i = 0; i < 20; i++)
+    {
+      count++;
+      edgeTicks = (now - 100) * EncodersMath::ticksPerMicrosecond;
+      EncodersMath::computeSpeed(state, count, edgeTicks,
+        now * EncodersMath::ticksPerMicrosecond, now);
+      now += 500;
+    }
+  }
+
+  uint16_t settledCalls = 0;
+  for (uint16_t call = 0; now < start + 400000; call++)
+  {
+    now += period + ((call % 3) == 0 ? 4 : 0) - ((call % 5) == 0 ? 4 : 0);
+
+    while (nextEdge <= now)
+    {
+      if (nextEdge >= start)
+      {
+        count++;
+        edgeTicks = nextEdge * EncodersMath::ticksPerMicrosecond;
+      }
+      nextEdge += edgeInterval;
+    }
+
+    int16_t estimate = EncodersMath::computeSpeed(state, count, edgeTicks,
+      now * EncodersMath::ticksPerMicrosecond, now);
+
+    // Once the wheel is turning, the estimate should never be above the
+    // real speed (by more than the rounding of the edge times), and it
+    // should settle to within 2%.
+    if (now < start) { continue; }
+    int32_t error = estimate - (int32_t)speed;
+    if (estimate < 0 || error * 100 > (int32_t)speed * 2 + 200)
+    {
+      if (failures++ < 10)
+      {
+        printf("speed %u, period %u, stop %u: estimate %d at %u us after start\n",
+          (unsigned)speed, (unsigned)period, (unsigned)stopTime, estimate,
+          (unsigned)(now - start));
+      }
+    }
+    if (error * 100 >= -(int32_t)speed * 2) { settledCalls++; }
+    else { settledCalls = 0; }
+  }
+
+  if (settledCalls < 50)
+  {
+    failures++;
+    printf("speed %u, period %u, stop %u: did not settle\n",
+      (unsigned)speed, (unsigned)period, (unsigned)stopTime);
+  }
+}
+
+int main()
+{
+  static const uint32_t speeds[] = { 50, 200, 1000, 5000 };
+  static const uint32_t periods[] = { 1000, 1500, 2000, 5000 };
+  static const uint32_t stops[] = { 31000, 40000, 100000, 1000000 };
+
+  for (uint8_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++)
+  {
+    for (uint8_t j = 0; j < sizeof(periods) / sizeof(periods[0]); j++)
+    {
+      for (uint8_t k = 0; k < sizeof(stops) / sizeof(stops[0]); k++)
+      {
+        testRestart(speeds[i], periods[j], stops[k], false);
+      }
+      testRestart(speeds[i], periods[j], 0, true);
+    }
+  }
+
+  if (failures)
+  {
+    printf("EncodersMathTest: %u failures\n", failures);
+    return 1;
+  }
+  printf("EncodersMathTest: passed\n");
+  return 0;
+}
@@ -0,0 +1,97 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+// Checks the fixed-point math used by LineSensors against the divisions it
+// replaces.
+
+#include <Pololu3piPlus32U4LineSensorsMath.h>
+#include <stdio.h>
+
+using namespace Pololu3piPlus32U4;
+
+static unsigned failures = 0;
+
+static void fail(const char * what, unsigned a, unsigned b,
+  unsigned expected, unsigned actual)
+{
+  if (failures++ < 10)
+  {
+    printf("%s(%u, %u): expected %u, got %u\n", what, a, b, expected, actual);
+  }
+}
+
+// Compares scaleReading() with the division that readCalibrated() used
+// before, (reading - calmin) * 1000 / (calmax - calmin) clamped to 0-1000,
+// for every offset from calmin and every nonzero calibrated range.  (The
+// division stored its result in an int16_t, which overflowed for readings
+// far above the maximum; the reference here does not.)
+static void testScaleReading()
+{
+  for (uint32_t denominator = 1; denominator <= 0xFFFF; denominator++)
+  {
+    uint32_t factor = LineSensorsMath::reciprocal(denominator);
+    uint16_t calmin = (0xFFFF - denominator) / 2;
+
+    // expected = floor(x * 1000 / denominator), kept up to date as x
+    // increases instead of dividing every time.
+    uint32_t expected = 0, remainder = 0;
+    for (uint32_t x = 0; x < denominator; x++)
+    {
+      uint16_t actual = LineSensorsMath::scaleReading(calmin + x, calmin, denominator, factor);
+      if (actual != expected) { fail("scaleReading", x, denominator, expected, actual); }
+
+      remainder += 1000;
+      while (remainder >= denominator) { remainder -= denominator; expected++; }
+    }
+
+    // Readings at or past the maximum, and at or below the minimum.
+    if (LineSensorsMath::scaleReading(denominator, 0, denominator, factor) != 1000 ||
+      LineSensorsMath::scaleReading(0xFFFF, 0, denominator, factor) != 1000 ||
+      LineSensorsMath::scaleReading(500, 500, denominator, factor) != 0 ||
+      LineSensorsMath::scaleReading(0, 500, denominator, factor) != 0)
+    {
+      fail("scaleReading limits", 0, denominator, 0, 0);
+    }
+  }
+
+  // An empty range always gives 0.
+  if (LineSensorsMath::scaleReading(2000, 1000, 0, LineSensorsMath::reciprocal(0)) != 0)
+  {
+    fail("scaleReading", 1000, 0, 0, 1);
+  }
+}
+
+// Compares removeAmbient() with the division it replaces for every pair of
+// readings below the largest timeout, with the largest limit and with the
+// default timeout.
+static void testRemoveAmbient()
+{
+  for (uint32_t off = 1; off < 32768; off++)
+  {
+    for (uint32_t on = 0; on < off; on++)
+    {
+      uint64_t quotient = (uint64_t)on * off / (off - on);
+
+      uint16_t expected = quotient > 32767 ? 32767 : quotient;
+      uint16_t actual = LineSensorsMath::removeAmbient(on, off, 32767);
+      if (actual != expected) { fail("removeAmbient", on, off, expected, actual); }
+
+      expected = quotient > 4000 ? 4000 : quotient;
+      actual = LineSensorsMath::removeAmbient(on, off, 4000);
+      if (actual != expected) { fail("removeAmbient", on, off, expected, actual); }
+    }
+  }
+}
+
+int main()
+{
+  testScaleReading();
+  testRemoveAmbient();
+
+  if (failures)
+  {
+    printf("LineSensorsMathTest: %u failures\n", failures);
+    return 1;
+  }
+  printf("LineSensorsMathTest: passed\n");
+  return 0;
+}
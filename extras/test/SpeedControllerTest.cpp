@@ -0,0 +1,350 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+// Checks the SpeedController PI loop, together with the wheel speed
+// estimator used by Encoders, against a simulated motor and encoder:
+// the step response from a standstill, a restart after the wheel has been
+// stopped, recovery from a stall, and recovery from an emergency stop.
+
+#include <Pololu3piPlus32U4SpeedControllerMath.h>
+#include <Pololu3piPlus32U4EncodersMath.h>
+#include <math.h>
+#include <stdio.h>
+
+using namespace Pololu3piPlus32U4;
+
+static unsigned failures = 0;
+
+static const int16_t kp = 100;        // SpeedController::defaultKp
+static const int16_t ki = 8;          // SpeedController::defaultKi
+static const int16_t maxOutput = 400;
+static const uint32_t period = 2000;  // SpeedController::defaultPeriod
+
+// A first-order model of a motor driving a wheel with an encoder: the speed
+// approaches gain * (output - friction) counts per second with the time
+// constant tau, so small outputs do not move the wheel.  Each encoder edge
+// records the timer ticks like the encoder ISRs do.
+struct Plant
+{
+  double gain = 10;        // counts per second per unit of output
+  double tau = 0.05;       // seconds
+  double friction = 15;    // units of output
+  double speed = 0;        // counts per second
+  double position = 0;     // counts
+  bool stalled = false;
+
+  uint16_t count = 0;
+  uint16_t edgeTicks = 0;
+
+  // Runs the model for dt microseconds, ending at time now.
+  void step(int16_t output, uint32_t dt, uint32_t now)
+  {
+    if (stalled)
+    {
+      speed = 0;
+      return;
+    }
+    double drive = 0;
+    if (output > friction) { drive = output - friction; }
+    if (output < -friction) { drive = output + friction; }
+    speed += (gain * drive - speed) * (dt * 1e-6) / tau;
+    double newPosition = position + speed * dt * 1e-6;
+    int32_t oldCount = (int32_t)floor(position);
+    int32_t newCount = (int32_t)floor(newPosition);
+    if (newCount != oldCount)
+    {
+      count += newCount - oldCount;
+      edgeTicks = now * EncodersMath::ticksPerMicrosecond;
+    }
+    position = newPosition;
+  }
+};
+
+// Runs the wheel under the control loop, with the estimator called from
+// the loop the way SpeedController does it.
+struct Simulation
+{
+  Plant plant;
+  EncodersMath::SpeedState estimator;
+  SpeedControllerMath::WheelControl control = SpeedControllerMath::WheelControl();
+  uint32_t now = 1000000;
+  int16_t output = 0;
+  int16_t estimate = 0;
+  uint32_t updates = 0;
+  bool emergencyStopped = false;
+
+  Simulation()
+  {
+    EncodersMath::resetSpeed(estimator, plant.count, now);
+  }
+
+  // The range of the real speed over the last few advances, which covers
+  // everything the estimator can be averaging over.
+  static const uint8_t historySize = 25;
+  double historyHigh[historySize] = {};
+  double historyLow[historySize] = {};
+  uint8_t historyIndex = 0;
+
+  // Runs the plant for the given time in microseconds without the loop.
+  void advance(uint32_t time)
+  {
+    historyIndex = (historyIndex + 1) % historySize;
+    double & high = historyHigh[historyIndex];
+    double & low = historyLow[historyIndex];
+    high = low = plant.speed;
+    for (uint32_t t = 0; t < time; t += 10)
+    {
+      uint32_t dt = (time - t < 10) ? time - t : 10;
+      now += dt;
+      plant.step(output, dt, now);
+      if (plant.speed > high) { high = plant.speed; }
+      if (plant.speed < low) { low = plant.speed; }
+    }
+  }
+
+  double recentHigh()
+  {
+    double high = historyHigh[0];
+    for (uint8_t i = 1; i < historySize; i++)
+    {
+      if (historyHigh[i] > high) { high = historyHigh[i]; }
+    }
+    return high;
+  }
+
+  double recentLow()
+  {
+    double low = historyLow[0];
+    for (uint8_t i = 1; i < historySize; i++)
+    {
+      if (historyLow[i] < low) { low = historyLow[i]; }
+    }
+    return low;
+  }
+
+  int16_t estimateSpeed()
+  {
+    return EncodersMath::computeSpeed(estimator, plant.count,
+      plant.edgeTicks, now * EncodersMath::ticksPerMicrosecond, now);
+  }
+
+  // Advances to the next update of the control loop, which comes one
+  // period later plus the 4 us jitter of micros().
+  void update()
+  {
+    advance(period + ((updates % 3) == 0 ? 4 : 0) - ((updates % 5) == 0 ? 4 : 0));
+    updates++;
+    estimate = estimateSpeed();
+    if (emergencyStopped)
+    {
+      // Like SpeedController's interrupt while Motors::emergencyStop() has
+      // the motors latched off.
+      SpeedControllerMath::hold(control, estimate);
+      output = 0;
+    }
+    else
+    {
+      output = SpeedControllerMath::control(control, estimate, kp, ki, maxOutput);
+    }
+  }
+
+  // Stops the loop and the motor for the given time, then starts the loop
+  // again the way SpeedController::stop() and start() do.
+  void restart(uint32_t stopTime)
+  {
+    output = 0;
+    advance(stopTime);
+    estimateSpeed();
+    control = SpeedControllerMath::WheelControl();
+  }
+
+  // Runs the loop for the given time in microseconds.
+  void run(uint32_t time)
+  {
+    uint32_t end = now + time;
+    while (now < end) { update(); }
+  }
+};
+
+static void fail(const char * test, int16_t target, const char * message,
+  double value)
+{
+  if (failures++ < 20)
+  {
+    printf("%s, target %d: %s (%.1f)\n", test, target, message, value);
+  }
+}
+
+// Runs the wheel towards target from wherever it is, and checks that it
+// gets there without overshooting by more than maxOvershoot (a fraction of
+// the target, or negative for no limit), that it settles within 300 ms, and
+// that neither the speed estimate nor the output spikes along the way.
+static void checkStep(Simulation & sim, const char * test, int16_t target,
+  double maxOvershoot)
+{
+  sim.control.target = target;
+  double sign = (target < 0) ? -1 : 1;
+  double peak = sim.plant.speed * sign;
+  bool reached = false;
+  uint32_t settleTime = 0;
+  uint32_t begin = sim.now;
+
+  while (sim.now - begin < 1000000)
+  {
+    sim.update();
+    double speed = sim.plant.speed * sign;
+    double estimate = sim.estimate * sign;
+
+    // The estimate is an average over the time since the previous edge, and
+    // it reads low for the first edges after a stop, so it can lag the real
+    // speed.  But it should never be much above the fastest the wheel has
+    // gone recently, or backwards unless the wheel recently went backwards.
+    double high = sim.recentHigh() * sign;
+    double low = sim.recentLow() * sign;
+    if (sign < 0) { double t = high; high = low; low = t; }
+    if (low > 0) { low = 0; }
+    if (estimate > high * 1.05 + 20 || estimate < low * 1.05 - 20)
+    {
+      fail(test, target, "estimate spiked", estimate);
+    }
+
+    // Until the wheel first gets near the target, the output should keep
+    // pushing it towards the target.
+    if (!reached && sim.output * sign < 0)
+    {
+      fail(test, target, "output reversed while accelerating", sim.output);
+    }
+
+    if (speed > peak) { peak = speed; }
+    if (speed >= target * sign * 0.9) { reached = true; }
+
+    if (fabs(speed - target * sign) > fabs(target * 0.03) + 10)
+    {
+      settleTime = sim.now - begin;
+    }
+  }
+
+  double overshoot = (peak - target * sign) / (target * sign);
+  if (maxOvershoot >= 0 && overshoot > maxOvershoot)
+  {
+    fail(test, target, "overshoot %", overshoot * 100);
+  }
+  if (settleTime > 300000)
+  {
+    fail(test, target, "settling time ms", settleTime / 1000.0);
+  }
+}
+
+static void testStartFromReset(int16_t target)
+{
+  Simulation sim;
+  checkStep(sim, "start", target, 0.15);
+}
+
+// Runs the wheel, stops the controller for a while, and starts it again,
+// so that the estimator sees a pause much longer than the edge timer can
+// measure.
+static void testRestart(int16_t target, uint32_t stopTime)
+{
+  Simulation sim;
+  sim.control.target = target;
+  sim.run(500000);
+  sim.restart(stopTime);
+  checkStep(sim, "restart", target, 0.15);
+}
+
+// Runs the wheel, brings it to a stop with a target of zero, and runs it
+// again without stopping the controller.
+static void testStopAndGo(int16_t target, uint32_t stopTime)
+{
+  Simulation sim;
+  sim.control.target = target;
+  sim.run(500000);
+  sim.control.target = 0;
+  sim.run(stopTime);
+  checkStep(sim, "stop and go", target, 0.15);
+}
+
+// Holds the wheel still while the controller is trying to run it, then
+// lets it go.  The output has to be saturated to push against the stall, so
+// the wheel overshoots when it is released, but the integral should hold no
+// more than it takes to saturate the output, so the wheel should settle as
+// quickly as it does from a normal start.
+static void testStall(int16_t target)
+{
+  Simulation sim;
+  sim.control.target = target;
+  sim.plant.stalled = true;
+  sim.run(1000000);
+  if (!sim.control.saturated)
+  {
+    fail("stall", target, "output not saturated while stalled", sim.output);
+  }
+  int32_t p = (int32_t)kp * target;
+  int32_t windup = (sim.control.integral + p) * (target < 0 ? -1 : 1) -
+    ((int32_t)maxOutput << SpeedControllerMath::gainShift);
+  if (windup > (int32_t)ki * (target < 0 ? -target : target))
+  {
+    fail("stall", target, "integral wound up past full output", windup);
+  }
+  sim.plant.stalled = false;
+  checkStep(sim, "stall release", target, -1);
+}
+
+// Runs the wheel into an obstacle that latches an emergency stop, holds it
+// there for a while, and then clears the stop after the obstacle is gone.
+// The first output after the stop should only have the proportional term
+// and one update's worth of integral, not be a full-power step, and the
+// wheel should then get back to speed normally.
+static void testEmergencyStop(int16_t target)
+{
+  Simulation sim;
+  sim.control.target = target;
+  sim.run(500000);
+  sim.emergencyStopped = true;
+  sim.plant.stalled = true;
+  sim.run(1000000);
+  if (sim.control.integral != 0)
+  {
+    fail("emergency stop", target, "integral changed while stopped",
+      sim.control.integral);
+  }
+
+  sim.plant.stalled = false;
+  sim.emergencyStopped = false;
+  sim.update();
+  int32_t expected = ((int32_t)(kp + ki) * (target - sim.estimate)) >>
+    SpeedControllerMath::gainShift;
+  int16_t magnitude = (sim.output < 0) ? -sim.output : sim.output;
+  if (sim.output != expected || magnitude >= maxOutput)
+  {
+    fail("emergency stop", target, "output stepped when the stop was cleared",
+      sim.output);
+  }
+  checkStep(sim, "emergency stop release", target, 0.15);
+}
+
+int main()
+{
+  static const int16_t targets[] = { 300, 1000, 2000, 3000, -1500 };
+  static const uint32_t stops[] = { 40000, 100000, 1000000 };
+
+  for (uint8_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++)
+  {
+    testStartFromReset(targets[i]);
+    for (uint8_t j = 0; j < sizeof(stops) / sizeof(stops[0]); j++)
+    {
+      testRestart(targets[i], stops[j]);
+      testStopAndGo(targets[i], stops[j]);
+    }
+    testStall(targets[i]);
+    testEmergencyStop(targets[i]);
+  }
+
+  if (failures)
+  {
+    printf("SpeedControllerTest: %u failures\n", failures);
+    return 1;
+  }
+  printf("SpeedControllerTest: passed\n");
+  return 0;
+}
@@ -22,6 +22,9 @@
 #include <Pololu3piPlus32U4LineSensors.h>
 #include <Pololu3piPlus32U4Motors.h>
 #include <Pololu3piPlus32U4OLED.h>
+#include <Pololu3piPlus32U4RCSensorArray.h>
+#include <Pololu3piPlus32U4SpeedController.h>
+#include <Pololu3piPlus32U4Timer3Clock.h>
 
 /// Top-level namespace for the Pololu3piPlus32U4 library.
 namespace Pololu3piPlus32U4
@@ -1,6 +1,7 @@
 // Copyright (C) Pololu Corporation.  See www.pololu.com for details.
 
 #include <Pololu3piPlus32U4BumpSensors.h>
+#include <Pololu3piPlus32U4SensorArrays.h>
 #include <FastGPIO.h>
 
 namespace Pololu3piPlus32U4
@@ -10,33 +11,7 @@ void BumpSensors::readRaw()
 {
   FastGPIO::Pin<emitterPin>::setOutputLow();  // Turn on the emitters.
 
-  FastGPIO::Pin<bumpLeftPin>::setOutputHigh();
-  FastGPIO::Pin<bumpRightPin>::setOutputHigh();
-  _delay_us(10);
-
-  sensorValues[0] = timeout;
-  sensorValues[1] = timeout;
-
-  noInterrupts();
-  uint16_t startTime = micros();
-  FastGPIO::Pin<bumpLeftPin>::setInput();
-  FastGPIO::Pin<bumpRightPin>::setInput();
-  interrupts();
-
-  while (true)
-  {
-    noInterrupts();
-    uint16_t time = micros() - startTime;
-    if (time >= timeout)
-    {
-      interrupts();
-      break;
-    }
-    if (!FastGPIO::Pin<bumpLeftPin>::isInputHigh() && time < sensorValues[0]) { sensorValues[0] = time; }
-    if (!FastGPIO::Pin<bumpRightPin>::isInputHigh() && time < sensorValues[1]) { sensorValues[1] = time; }
-    interrupts();
-    __builtin_avr_delay_cycles(4);  // allow interrupts to run
-  }
+  BumpArray::read(sensorValues, timeout);
 
   FastGPIO::Pin<emitterPin>::setInput();  // turn off the emitters
 }
@@ -61,21 +36,118 @@ void BumpSensors::calibrate(uint8_t count)
     // reading timed out, consider the bump sensor pressed).
     threshold[s] = baseline[s] + baseline[s] * (uint32_t)marginPercentage / 100;
     if (threshold[s] > timeout) { threshold[s] = timeout; }
+
+    saturation[s] = timeout;
+  }
+}
+
+void BumpSensors::calibratePressed(uint8_t count)
+{
+  uint32_t sum[2] = {0, 0};
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    readRaw();
+    sum[BumpLeft]  += sensorValues[BumpLeft];
+    sum[BumpRight] += sensorValues[BumpRight];
+  }
+
+  for (uint8_t s = BumpLeft; s <= BumpRight; s++)
+  {
+    saturation[s] = (sum[s] + count / 2) / count;
   }
 }
 
 uint8_t BumpSensors::read()
 {
   readRaw();
+  uint8_t bitField = update();
+  if (measureDepth) { updateDepth(); }
+  return bitField;
+}
+
+uint8_t BumpSensors::readFast()
+{
+  FastGPIO::Pin<emitterPin>::setOutputLow();  // Turn on the emitters.
 
+  // A pressed sensor only needs to be timed until it has passed its release
+  // threshold.
+  uint16_t limits[2];
+  for (uint8_t s = BumpLeft; s <= BumpRight; s++)
+  {
+    limits[s] = pressed[s] ? getReleaseThreshold(s) : threshold[s];
+  }
+  BumpArray::readWithLimits(sensorValues, limits);
+
+  FastGPIO::Pin<emitterPin>::setInput();  // turn off the emitters
+
+  return update();
+}
+
+uint16_t BumpSensors::getReleaseThreshold(uint8_t side)
+{
+  uint16_t t = threshold[side];
+  uint16_t b = baseline[side];
+  if (t <= b) { return t; }
+
+  // This can be called from the background sampling interrupt, so it
+  // multiplies by 41/4096 instead of dividing by 100.
+  uint16_t percentage = (hysteresisPercentage < 1000) ? hysteresisPercentage : 1000;
+  uint32_t hysteresis = ((uint32_t)b * percentage * 41) >> 12;
+  uint16_t margin = t - b;
+  if (hysteresis > margin) { hysteresis = margin; }
+  return t - hysteresis;
+}
+
+// Updates the pressed states from the raw readings in sensorValues.
+uint8_t BumpSensors::update()
+{
   uint8_t bitField = 0;
   for (uint8_t s = BumpLeft; s <= BumpRight; s++)
   {
     last[s] = pressed[s];
-    pressed[s] = (sensorValues[s] >= threshold[s]);
+    uint16_t limit = pressed[s] ? getReleaseThreshold(s) : threshold[s];
+    pressed[s] = (sensorValues[s] >= limit);
     bitField |= pressed[s] << s;
   }
   return bitField;
 }
 
+// Updates the press depths and their rates of change from sensorValues.
+void BumpSensors::updateDepth()
+{
+  uint32_t now = micros();
+  uint32_t dt = now - lastDepthTime;
+  lastDepthTime = now;
+  if (dt == 0) { dt = 1; }
+  if (dt > 1000000) { dt = 1000000; }
+
+  for (uint8_t s = BumpLeft; s <= BumpRight; s++)
+  {
+    uint16_t newDepth;
+    if (sensorValues[s] <= baseline[s])
+    {
+      newDepth = 0;
+    }
+    else if (sensorValues[s] >= saturation[s] || saturation[s] <= baseline[s])
+    {
+      newDepth = 1000;
+    }
+    else
+    {
+      newDepth = (uint32_t)(sensorValues[s] - baseline[s]) * 1000 /
+        (saturation[s] - baseline[s]);
+    }
+
+    // depth units per second, limited so that the smoothed rate, shifted
+    // left by up to 8 bits, fits in 32 bits
+    int32_t rate = ((int32_t)newDepth - depth[s]) * 1000000 / (int32_t)dt;
+    if (rate > 1000000) { rate = 1000000; }
+    if (rate < -1000000) { rate = -1000000; }
+
+    rateState[s] += rate - (rateState[s] >> rateShift);
+    depth[s] = newDepth;
+  }
+}
+
 }
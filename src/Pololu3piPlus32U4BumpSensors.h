@@ -9,6 +9,22 @@
 namespace Pololu3piPlus32U4
 {
 
+/// \brief A change in the debounced state of a bump sensor, recorded by
+/// background sampling.
+///
+/// See BumpSensors::startBackgroundSampling().
+struct BumpEvent
+{
+  /// The value of `micros()` when the change was detected.
+  uint32_t time;
+
+  /// The bump sensor that changed, as a member of the ::BumpSide enum.
+  uint8_t side;
+
+  /// True if the bump sensor was pressed; false if it was released.
+  bool pressed;
+};
+
 /// Bump sensor sides.
 enum BumpSide {
   /// Left bump sensor
@@ -50,6 +66,17 @@ class BumpSensors
     /// \f]
     void calibrate(uint8_t count = 50);
 
+    /// \brief Calibrates the fully pressed readings of the bump sensors.
+    ///
+    /// \param count The number of times to read the sensors during
+    /// calibration. The default is 50.
+    ///
+    /// This method reads the bump sensors a number of times while you hold
+    /// both of them pressed all the way in, and stores the average readings
+    /// in #saturation. Call it after calibrate(). It is optional: without it,
+    /// pressDepth() treats a reading of #timeout as fully pressed.
+    void calibratePressed(uint8_t count = 50);
+
     /// \brief Reads both bump sensors.
     ///
     /// \return A bit field indicating whether each bump sensor is pressed. The
@@ -66,6 +93,28 @@ class BumpSensors
     /// sensors.
     uint8_t read();
 
+    /// \brief Reads both bump sensors, stopping as soon as their states are
+    /// known.
+    ///
+    /// \return A bit field indicating whether each bump sensor is pressed, in
+    /// the same format as the return value of read().
+    ///
+    /// This works like read(), but it stops timing each sensor once its
+    /// reading reaches its threshold, since that is enough to know that the
+    /// sensor is pressed.  The readings stored in #sensorValues are therefore
+    /// capped at the thresholds.
+    ///
+    /// When neither sensor is pressed, both sensors fall well before their
+    /// thresholds and this takes the same time as read().  When a sensor is
+    /// pressed, read() has to wait for the full #timeout (4000 &micro;s, or
+    /// 64,000 CPU cycles, by default), while this only waits until the
+    /// threshold, which is usually a few hundred microseconds.  In either
+    /// case the read takes about 16 CPU cycles per microsecond of the larger
+    /// of the two times, plus 10 &micro;s for charging the sensors.
+    ///
+    /// You must call calibrate() before using this method.
+    uint8_t readFast();
+
     /// \brief Indicates whether the left bump sensor's state has changed.
     ///
     /// \return True if the left bump sensor's state has changed between the
@@ -91,6 +140,34 @@ class BumpSensors
     /// call to read(); false otherwise.
     bool rightIsPressed() { return pressed[BumpRight]; }
 
+    /// \brief Returns how far a bump sensor is pressed.
+    ///
+    /// \param side The bump sensor, as a member of the ::BumpSide enum.
+    ///
+    /// \return A number from 0 (the reading is at or below the baseline) to
+    /// 1000 (the reading is at or above the #saturation point), scaled
+    /// linearly in between, from the most recent call to read() while
+    /// #measureDepth was true.
+    ///
+    /// Unlike leftIsPressed() and rightIsPressed(), this lets you tell a light
+    /// touch from a hard hit, for example to back away from a wall by a
+    /// distance that depends on how hard the robot ran into it. It is not
+    /// updated by readFast(), which stops timing at the threshold.
+    uint16_t pressDepth(uint8_t side) { return depth[side]; }
+
+    /// \brief Returns how fast the press depth of a bump sensor is changing.
+    ///
+    /// \param side The bump sensor, as a member of the ::BumpSide enum.
+    ///
+    /// \return The rate of change of pressDepth() in depth units per second
+    /// (so 1000 means going from not pressed to fully pressed in one second),
+    /// smoothed over recent reads as described for #rateShift, from the reads
+    /// done while #measureDepth was true. Positive values
+    /// mean the sensor is being pressed in further. A hard collision can
+    /// reach tens of thousands; the rate measured between two reads is
+    /// limited to &plusmn;1,000,000 (fully pressed in a millisecond).
+    int32_t pressRate(uint8_t side) { return rateState[side] >> rateShift; }
+
     /// \brief The amount, as a percentage, that will be added to the measured
     /// baseline to get the threshold.
     ///
@@ -102,19 +179,156 @@ class BumpSensors
     /// Baseline readings obtained from calibration.
     uint16_t baseline[2];
 
-    /// Thresholds for bump sensor press detection.
+    /// \brief Thresholds for bump sensor press detection.
+    ///
+    /// calibrate() sets these from the baselines and #marginPercentage, but
+    /// you can also adjust them yourself after calibrating. The thresholds
+    /// for releasing (see getReleaseThreshold()) follow any change.
     uint16_t threshold[2];
 
+    /// \brief The amount, as a percentage of the baseline, by which a
+    /// pressed sensor's reading must drop below its threshold before it
+    /// counts as released.
+    ///
+    /// This hysteresis keeps a sensor that is barely pressed from flickering
+    /// between pressed and released. The default is 0 (no hysteresis).
+    /// Changes take effect right away.
+    uint16_t hysteresisPercentage = 0;
+
+    /// \brief Returns the threshold that the reading of a pressed bump
+    /// sensor must fall below for it to register as released.
+    ///
+    /// \param side The bump sensor, as a member of the ::BumpSide enum.
+    ///
+    /// This is the sensor's #threshold minus #hysteresisPercentage percent of
+    /// its baseline (to within 0.1%), but never less than the baseline. It is
+    /// calculated from the current values each time it is needed.
+    uint16_t getReleaseThreshold(uint8_t side);
+
+    /// \brief Readings of fully pressed bump sensors, used for pressDepth().
+    ///
+    /// calibrate() sets these to #timeout, and calibratePressed() measures
+    /// them.
+    uint16_t saturation[2];
+
+    /// \brief If true, read() updates pressDepth() and pressRate().
+    ///
+    /// This takes a call to `micros()` and a few 32-bit divisions, about
+    /// 100 &micro;s, on each read, so it is off by default. The default is
+    /// false.
+    bool measureDepth = false;
+
+    /// \brief How much pressRate() is smoothed.
+    ///
+    /// Each read moves the rate 1/2<sup>rateShift</sup> of the way towards
+    /// the rate measured since the previous read. Must be at most 8. The
+    /// default is 2.
+    uint8_t rateShift = 2;
+
     /// Raw reflectance sensor readings.
     uint16_t sensorValues[2];
 
     /// Timeout for bump sensor readings (in microseconds).
     uint16_t timeout = defaultTimeout;
 
+    /// Default sampling period for background sampling (in microseconds).
+    static const uint16_t defaultBackgroundPeriod = 5000;
+
+    /// The number of background events that can be queued.
+    static const uint8_t eventQueueSize = 8;
+
+    /// \brief Starts sampling the bump sensors in the background.
+    ///
+    /// \param period The time between samples, in microseconds. The default
+    /// is 5000 (200 samples per second), and the maximum is 30000.
+    ///
+    /// Once this is called, a Timer 3 compare interrupt (see Timer3Clock)
+    /// reads the bump sensors every \p period microseconds without blocking
+    /// your sketch. Each sample only needs to find out whether each sensor
+    /// takes longer than its threshold to fall, so it ends as soon as both
+    /// sides are decided, and it spends only a few microseconds in interrupt
+    /// context.
+    ///
+    /// A sensor has to read the same way for #debounceSamples samples in a row
+    /// before its state changes, and each change is added to a queue as a
+    /// BumpEvent that you can read with getEvent().
+    ///
+    /// You must call calibrate() before starting background sampling, and you
+    /// should not call read() or calibrate() while it is running. The bump
+    /// sensors are not sampled while the line sensor emitters are on.
+    ///
+    /// Example usage:
+    /// ~~~{.cpp}
+    /// bumpSensors.calibrate();
+    /// bumpSensors.startBackgroundSampling();
+    /// ...
+    /// BumpEvent event;
+    /// while (bumpSensors.getEvent(event))
+    /// {
+    ///   if (event.pressed && event.side == BumpLeft) { ... }
+    /// }
+    /// ~~~
+    void startBackgroundSampling(uint16_t period = defaultBackgroundPeriod);
+
+    /// \brief Stops sampling the bump sensors in the background.
+    ///
+    /// Events that are already in the queue can still be read with
+    /// getEvent().
+    void stopBackgroundSampling();
+
+    /// \brief Gets the oldest event from the background sampling queue.
+    ///
+    /// \param[out] event The event.
+    ///
+    /// \return True if there was an event; false if the queue was empty.
+    bool getEvent(BumpEvent & event);
+
+    /// \brief Returns the debounced state of the bump sensors from
+    /// background sampling.
+    ///
+    /// \return A bit field in the same format as the return value of read().
+    uint8_t getBackgroundState();
+
+    /// \brief Returns the number of events that were discarded because the
+    /// queue was full, and resets the count.
+    ///
+    /// The queue holds #eventQueueSize events, so this should stay at zero as
+    /// long as your sketch calls getEvent() regularly.
+    uint8_t getDroppedEventCount();
+
+    /// The number of consecutive background samples that must agree before a
+    /// bump sensor's debounced state changes. The default is 2.
+    uint8_t debounceSamples = 2;
+
+    /// \brief If true, background sampling stops the motors as soon as
+    /// either bump sensor goes from not pressed to pressed.
+    ///
+    /// The motors are stopped with Motors::emergencyStop() directly from the
+    /// sampling interrupt, without waiting for debouncing or for your sketch
+    /// to notice, and they stay stopped until your sketch calls
+    /// Motors::clearEmergencyStop().
+    ///
+    /// Only the start of a contact stops the motors: a sensor that stays
+    /// pressed does not stop them again, so after clearing the stop your
+    /// sketch can back away from an obstacle it is still touching. The stop
+    /// is armed again for a sensor as soon as one sample reads it as not
+    /// pressed. A sensor that is already pressed when background sampling
+    /// starts counts as a new contact. The time from contact to the motor
+    /// outputs going low is at most the background sampling period plus
+    /// 10 &micro;s of charging time plus the larger threshold, plus a few
+    /// microseconds of interrupt latency: about 5.5 ms with the default
+    /// period. The default is false.
+    bool stopMotorsOnContact = false;
+
   private:
     void readRaw();
+    uint8_t update();
+    void updateDepth();
     uint8_t pressed[2];
     uint8_t last[2];
+    uint16_t depth[2];
+    int32_t rateState[2];  // the rate, shifted left by rateShift
+    uint32_t lastDepthTime;
 };
 
 }
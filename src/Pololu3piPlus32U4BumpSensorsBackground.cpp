@@ -0,0 +1,266 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+// Background bump sensor sampling.  This is kept apart from the rest of
+// BumpSensors so that the Timer 3 compare B interrupt it needs is only
+// linked into sketches that call startBackgroundSampling().
+
+#include <Pololu3piPlus32U4BumpSensors.h>
+#include <Pololu3piPlus32U4Motors.h>
+#include <Pololu3piPlus32U4SensorArrays.h>
+#include <Pololu3piPlus32U4Timer3Clock.h>
+#include <FastGPIO.h>
+
+namespace Pololu3piPlus32U4
+{
+
+// State of background sampling.  Each sample is a sequence of Timer 3
+// compare B interrupts: one to turn on the emitters and start charging the
+// sensors, one to release them, and then one at each threshold time that is
+// still undecided.
+enum BackgroundPhase : uint8_t { BackgroundIdle, BackgroundCharging, BackgroundDischarging };
+
+static BumpSensors * backgroundSensors;
+static uint8_t backgroundPhase;
+static uint16_t backgroundPeriodTicks;
+static uint16_t backgroundSampleTicks;  // when the current sample was due
+static uint16_t backgroundReleaseTicks;
+static uint8_t backgroundUndecided;     // bit for each side still to decide
+static uint8_t backgroundRaw;           // bit for each side that read pressed
+static uint8_t backgroundLastRaw;       // backgroundRaw from the last valid sample
+static uint8_t backgroundAgree[2];      // samples in a row that disagreed with the state
+static volatile uint8_t backgroundState;
+
+// Single-producer single-consumer queue: the ISR only writes eventHead and
+// getEvent() only writes eventTail, so neither needs to disable interrupts.
+static volatile BumpEvent eventQueue[BumpSensors::eventQueueSize];
+static volatile uint8_t eventHead;
+static volatile uint8_t eventTail;
+static volatile uint8_t droppedEvents;
+
+static_assert((BumpSensors::eventQueueSize & (BumpSensors::eventQueueSize - 1)) == 0,
+  "eventQueueSize must be a power of two");
+
+static void pushEvent(uint8_t side, bool pressed)
+{
+  uint8_t head = eventHead;
+  uint8_t next = (head + 1) & (BumpSensors::eventQueueSize - 1);
+  if (next == eventTail)
+  {
+    if (droppedEvents != 0xFF) { droppedEvents++; }
+    return;
+  }
+  eventQueue[head].time = micros();
+  eventQueue[head].side = side;
+  eventQueue[head].pressed = pressed;
+  eventHead = next;
+}
+
+// Sets the next compare match to delay ticks after the time from, or to a
+// few ticks from now if that has already passed.  The delay can be up to a
+// whole timer period (the longest sampling period is 60000 ticks), so this
+// compares unsigned tick counts instead of taking a signed difference.
+static void scheduleBackground(uint16_t from, uint16_t delay)
+{
+  uint16_t now = TCNT3;
+  uint16_t elapsed = now - from;
+  if (elapsed >= delay || delay - elapsed < 8)
+  {
+    OCR3B = now + 8;
+  }
+  else
+  {
+    OCR3B = from + delay;
+  }
+}
+
+static inline uint16_t thresholdTicks(uint16_t threshold)
+{
+  if (threshold > 16000) { threshold = 16000; }
+  return threshold * Timer3Clock::ticksPerMicrosecond;
+}
+
+// Returns true if the emitter pin is still driving the bump emitters, which
+// is how we left it unless other code took over the pin during the sample.
+static inline bool bumpEmittersOn()
+{
+  return FastGPIO::Pin<BumpSensors::emitterPin>::isOutput() &&
+    !FastGPIO::Pin<BumpSensors::emitterPin>::isOutputValueHigh();
+}
+
+static void finishBackgroundSample(bool valid)
+{
+  BumpArray::release();
+  if (bumpEmittersOn()) { FastGPIO::Pin<BumpSensors::emitterPin>::setInput(); }
+
+  if (valid)
+  {
+    backgroundLastRaw = backgroundRaw;
+
+    uint8_t state = backgroundState;
+    for (uint8_t s = BumpLeft; s <= BumpRight; s++)
+    {
+      uint8_t bit = 1 << s;
+      if ((backgroundRaw ^ state) & bit)
+      {
+        if (++backgroundAgree[s] >= backgroundSensors->debounceSamples)
+        {
+          backgroundAgree[s] = 0;
+          state ^= bit;
+          pushEvent(s, state & bit);
+        }
+      }
+      else
+      {
+        backgroundAgree[s] = 0;
+      }
+    }
+    backgroundState = state;
+  }
+
+  backgroundPhase = BackgroundIdle;
+  scheduleBackground(backgroundSampleTicks, backgroundPeriodTicks);
+}
+
+ISR(TIMER3_COMPB_vect)
+{
+  switch (backgroundPhase)
+  {
+  case BackgroundIdle:
+    backgroundSampleTicks = OCR3B;
+    if (FastGPIO::Pin<BumpSensors::emitterPin>::isOutput())
+    {
+      // Something else (probably a line sensor read) is using the emitters,
+      // so skip this sample.
+      scheduleBackground(backgroundSampleTicks, backgroundPeriodTicks);
+      return;
+    }
+    FastGPIO::Pin<BumpSensors::emitterPin>::setOutputLow();
+    BumpArray::charge();
+    backgroundPhase = BackgroundCharging;
+    scheduleBackground(TCNT3, 10 * Timer3Clock::ticksPerMicrosecond);
+    return;
+
+  case BackgroundCharging:
+    if (!bumpEmittersOn()) { finishBackgroundSample(false); return; }
+    backgroundReleaseTicks = TCNT3;
+    BumpArray::release();
+    backgroundUndecided = (1 << BumpLeft) | (1 << BumpRight);
+    backgroundRaw = 0;
+    backgroundPhase = BackgroundDischarging;
+    break;
+
+  default:
+    if (!bumpEmittersOn()) { finishBackgroundSample(false); return; }
+    break;
+  }
+
+  // A sensor that has fallen is not pressed, and a sensor that is still high
+  // at its threshold time is pressed.  Anything else has to be looked at
+  // again at its threshold time.  (If this interrupt is delayed past a
+  // threshold, a sensor that fell in the meantime counts as not pressed, but
+  // debouncing smooths that over.)
+  uint16_t elapsed = TCNT3 - backgroundReleaseTicks;
+  bool high[2] = {
+    FastGPIO::Pin<BumpSensors::bumpLeftPin>::isInputHigh(),
+    FastGPIO::Pin<BumpSensors::bumpRightPin>::isInputHigh(),
+  };
+  uint16_t next = 0xFFFF;
+  for (uint8_t s = BumpLeft; s <= BumpRight; s++)
+  {
+    uint8_t bit = 1 << s;
+    if (!(backgroundUndecided & bit)) { continue; }
+
+    uint16_t t = thresholdTicks((backgroundState & bit) ?
+      backgroundSensors->getReleaseThreshold(s) : backgroundSensors->threshold[s]);
+    if (!high[s])
+    {
+      backgroundUndecided &= ~bit;
+    }
+    else if (elapsed >= t)
+    {
+      backgroundRaw |= bit;
+      backgroundUndecided &= ~bit;
+      // Only stop the motors when contact starts, so that once the sketch
+      // clears the stop, it can drive away from whatever it is touching.
+      if (backgroundSensors->stopMotorsOnContact && !(backgroundLastRaw & bit))
+      {
+        Motors::emergencyStop();
+      }
+    }
+    else if (t < next)
+    {
+      next = t;
+    }
+  }
+
+  if (backgroundUndecided)
+  {
+    scheduleBackground(backgroundReleaseTicks, next);
+  }
+  else
+  {
+    finishBackgroundSample(true);
+  }
+}
+
+void BumpSensors::startBackgroundSampling(uint16_t period)
+{
+  if (period > 30000) { period = 30000; }
+
+  Timer3Clock::init();
+  stopBackgroundSampling();
+
+  backgroundSensors = this;
+  backgroundPeriodTicks = period * Timer3Clock::ticksPerMicrosecond;
+  backgroundPhase = BackgroundIdle;
+  backgroundAgree[BumpLeft] = 0;
+  backgroundAgree[BumpRight] = 0;
+  backgroundState = 0;
+  backgroundLastRaw = 0;
+
+  noInterrupts();
+  OCR3B = TCNT3 + backgroundPeriodTicks;
+  TIFR3 = (1 << OCF3B);  // Clear its interrupt flag by writing a 1.
+  TIMSK3 |= (1 << OCIE3B);
+  interrupts();
+}
+
+void BumpSensors::stopBackgroundSampling()
+{
+  noInterrupts();
+  TIMSK3 &= ~(1 << OCIE3B);
+  if (backgroundPhase != BackgroundIdle)
+  {
+    BumpArray::release();
+    if (bumpEmittersOn()) { FastGPIO::Pin<emitterPin>::setInput(); }
+    backgroundPhase = BackgroundIdle;
+  }
+  interrupts();
+}
+
+bool BumpSensors::getEvent(BumpEvent & event)
+{
+  uint8_t tail = eventTail;
+  if (tail == eventHead) { return false; }
+  event.time = eventQueue[tail].time;
+  event.side = eventQueue[tail].side;
+  event.pressed = eventQueue[tail].pressed;
+  eventTail = (tail + 1) & (eventQueueSize - 1);
+  return true;
+}
+
+uint8_t BumpSensors::getBackgroundState()
+{
+  return backgroundState;
+}
+
+uint8_t BumpSensors::getDroppedEventCount()
+{
+  noInterrupts();
+  uint8_t count = droppedEvents;
+  droppedEvents = 0;
+  interrupts();
+  return count;
+}
+
+}
@@ -1,6 +1,8 @@
 // Copyright (C) Pololu Corporation.  See www.pololu.com for details.
 
 #include <Pololu3piPlus32U4Encoders.h>
+#include <Pololu3piPlus32U4EncodersMath.h>
+#include <Pololu3piPlus32U4Timer3Clock.h>
 #include <FastGPIO.h>
 #include <avr/interrupt.h>
 #include <Arduino.h>
@@ -13,53 +15,233 @@
 namespace Pololu3piPlus32U4
 {
 
-static volatile bool lastLeftA;
-static volatile bool lastLeftB;
-static volatile bool lastRightA;
-static volatile bool lastRightB;
-
-static volatile bool errorLeft;
-static volatile bool errorRight;
+// Quadrature decoding table, indexed by the previous state of the A and B
+// signals in bits 3-2 and the new state in bits 1-0.  A change of both
+// signals at once means that an edge was missed, so the direction is unknown.
+static const int8_t quadratureError = 2;
+static const int8_t quadratureTable[16] = {
+     0, -1,  1,  quadratureError,
+     1,  0,  quadratureError, -1,
+    -1,  quadratureError,  0,  1,
+     quadratureError,  1, -1,  0,
+};
+
+// The state of each encoder is kept in one byte: bit 1 is the last value
+// of the A signal, bit 0 is the last value of the B signal, and errorBit is
+// set when an error is detected.
+static const uint8_t errorBit = 1 << 2;
+static volatile uint8_t stateLeft;
+static volatile uint8_t stateRight;
 
 // These count variables are uint16_t instead of int16_t because
 // signed integer overflow is undefined behavior in C++.
 static volatile uint16_t countLeft;
 static volatile uint16_t countRight;
 
-ISR(PCINT0_vect)
-{
-    bool newLeftB = FastGPIO::Pin<LEFT_B>::isInputHigh();
-    bool newLeftA = FastGPIO::Pin<LEFT_XOR>::isInputHigh() ^ newLeftB;
+// The 32-bit totals returned by snapshot(), as of when the 16-bit counts
+// above were last seen to be lastLeft and lastRight.
+static int32_t totalLeft;
+static int32_t totalRight;
+static uint16_t lastLeft;
+static uint16_t lastRight;
+
+// Timer 3 ticks at the most recent edge of each encoder.  These are only
+// recorded once edgeTiming has been set by getSpeedLeft() or getSpeedRight().
+static volatile bool edgeTiming;
+static volatile uint16_t edgeTicksLeft;
+static volatile uint16_t edgeTicksRight;
 
-    countLeft += (newLeftA ^ lastLeftB) - (lastLeftA ^ newLeftB);
+// State kept between calls to getSpeedLeft() or getSpeedRight().
+typedef EncodersMath::SpeedState SpeedState;
 
-    if((lastLeftA ^ newLeftA) & (lastLeftB ^ newLeftB))
+static_assert(EncodersMath::ticksPerMicrosecond == Timer3Clock::ticksPerMicrosecond,
+    "EncodersMath must use the Timer3Clock tick rate");
+
+static SpeedState speedLeft;
+static SpeedState speedRight;
+
+// Updates an encoder's count and state for new values of its A and B
+// signals, given as 0 or 1.  Returns true if there was an error.
+static inline bool decode(volatile uint8_t & state, volatile uint16_t & count,
+    uint8_t a, uint8_t b)
+{
+    uint8_t s = state;
+    uint8_t ab = (a << 1) | b;
+    int8_t delta = quadratureTable[((s & 3) << 2) | ab];
+    bool error = (delta == quadratureError);
+    if (error)
     {
-        errorLeft = true;
+        s |= errorBit;
     }
+    else
+    {
+        count += delta;
+    }
+    state = (s & errorBit) | ab;
+    return error;
+}
+
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+// Diagnostic data for one encoder, only updated by its ISR.
+struct DiagnosticState
+{
+    bool haveEdge;          // true if lastEdgeTicks is valid
+    uint16_t lastEdgeTicks;
+    uint16_t lastEdgeOverflows;  // timer3Overflows at the last edge
+    uint16_t minInterval;   // in ticks
+    uint32_t edges;
+    uint16_t errors;
+    uint32_t busyTicks;
+    uint16_t histogram[EncoderDiagnostics::histogramSize];
+};
+
+static DiagnosticState diagnosticsLeft;
+static DiagnosticState diagnosticsRight;
+
+// The number of times Timer 3 has overflowed, so that the time between two
+// edges can be checked before it is measured with the 16-bit timer.
+static volatile uint16_t timer3Overflows;
+
+ISR(TIMER3_OVF_vect)
+{
+    timer3Overflows++;
+}
 
-    lastLeftA = newLeftA;
-    lastLeftB = newLeftB;
+// Returns the number of Timer 3 overflows as of when the timer read ticks,
+// from an ISR.  An overflow that happened since the ISR started is still
+// pending, and it came before the read if the ticks are low.
+static inline uint16_t overflowsAt(uint16_t ticks)
+{
+    uint16_t overflows = timer3Overflows;
+    if ((TIFR3 & (1 << TOV3)) && ticks < 0x8000) { overflows++; }
+    return overflows;
 }
 
-static void rightISR()
+static inline void recordEdge(DiagnosticState & d, uint16_t startTicks, bool error)
 {
-    bool newRightB = FastGPIO::Pin<RIGHT_B>::isInputHigh();
-    bool newRightA = FastGPIO::Pin<RIGHT_XOR>::isInputHigh() ^ newRightB;
+    d.edges++;
+    if (error && d.errors != 0xFFFF) { d.errors++; }
 
-    countRight += (newRightA ^ lastRightB) - (lastRightA ^ newRightB);
+    uint16_t overflows = overflowsAt(startTicks);
+    if (d.haveEdge)
+    {
+        // The interval can only be measured in ticks if the timer has not
+        // gone all the way around since the last edge.  Longer intervals,
+        // like the first one after the wheel stops, are counted in the last
+        // histogram bin but not used for minInterval.
+        uint16_t wraps = overflows - d.lastEdgeOverflows;
+        bool measurable = (wraps == 0) ||
+            (wraps == 1 && startTicks < d.lastEdgeTicks);
+        uint16_t interval = measurable ? startTicks - d.lastEdgeTicks : 0xFFFF;
+        if (measurable && interval < d.minInterval) { d.minInterval = interval; }
+
+        // Bin 0 is for intervals below 16 us (32 ticks), and each bin after
+        // that is for intervals up to twice as long as the one before.
+        uint16_t v = interval >> 5;
+        uint8_t bin = 0;
+        while (v && bin < EncoderDiagnostics::histogramSize - 1)
+        {
+            v >>= 1;
+            bin++;
+        }
+        if (d.histogram[bin] != 0xFFFF) { d.histogram[bin]++; }
+    }
+    d.haveEdge = true;
+    d.lastEdgeTicks = startTicks;
+    d.lastEdgeOverflows = overflows;
+}
 
-    if((lastRightA ^ newRightA) & (lastRightB ^ newRightB))
+static void clearDiagnostics(DiagnosticState & d)
+{
+    d.haveEdge = false;
+    d.minInterval = 0xFFFF;
+    d.edges = 0;
+    d.errors = 0;
+    d.busyTicks = 0;
+    for (uint8_t i = 0; i < EncoderDiagnostics::histogramSize; i++)
     {
-        errorRight = true;
+        d.histogram[i] = 0;
     }
+}
 
-    lastRightA = newRightA;
-    lastRightB = newRightB;
+static void copyDiagnostics(const DiagnosticState & d, EncoderDiagnostics & diagnostics)
+{
+    diagnostics.edges = d.edges;
+    diagnostics.errors = d.errors;
+    diagnostics.minInterval = (d.minInterval == 0xFFFF) ? 0xFFFF :
+        d.minInterval / Timer3Clock::ticksPerMicrosecond;
+    diagnostics.busyTime = d.busyTicks / Timer3Clock::ticksPerMicrosecond;
+    for (uint8_t i = 0; i < EncoderDiagnostics::histogramSize; i++)
+    {
+        diagnostics.histogram[i] = d.histogram[i];
+    }
 }
+#endif
+
+ISR(PCINT0_vect)
+{
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    uint16_t startTicks = TCNT3;
+#endif
+
+    uint8_t b = FastGPIO::Pin<LEFT_B>::isInputHigh();
+    uint8_t a = FastGPIO::Pin<LEFT_XOR>::isInputHigh() ^ b;
+    bool error = decode(stateLeft, countLeft, a, b);
+    (void)error;
+
+    if (edgeTiming) { edgeTicksLeft = TCNT3; }
+
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    recordEdge(diagnosticsLeft, startTicks, error);
+    diagnosticsLeft.busyTicks += (uint16_t)(TCNT3 - startTicks);
+#endif
+}
+
+static inline void rightEdge()
+{
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    uint16_t startTicks = TCNT3;
+#endif
+
+    uint8_t b = FastGPIO::Pin<RIGHT_B>::isInputHigh();
+    uint8_t a = FastGPIO::Pin<RIGHT_XOR>::isInputHigh() ^ b;
+    bool error = decode(stateRight, countRight, a, b);
+    (void)error;
+
+    if (edgeTiming) { edgeTicksRight = TCNT3; }
+
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    recordEdge(diagnosticsRight, startTicks, error);
+    diagnosticsRight.busyTicks += (uint16_t)(TCNT3 - startTicks);
+#endif
+}
+
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_INT6
+ISR(INT6_vect)
+{
+    rightEdge();
+}
+#else
+static void rightISR()
+{
+    rightEdge();
+}
+#endif
 
 void Encoders::init2()
 {
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    Timer3Clock::init();
+    clearDiagnostics(diagnosticsLeft);
+    clearDiagnostics(diagnosticsRight);
+
+    uint8_t sreg = SREG;
+    cli();
+    TIFR3 = (1 << TOV3);  // Clear its interrupt flag by writing a 1.
+    TIMSK3 |= (1 << TOIE3);
+    SREG = sreg;
+#endif
+
     // Set the pins as pulled-up inputs.
     FastGPIO::Pin<LEFT_XOR>::setInputPulledUp();
     FastGPIO::Pin<LEFT_B>::setInputPulledUp();
@@ -72,23 +254,30 @@ void Encoders::init2()
     PCMSK0 = (1 << PCINT4);
     PCIFR = (1 << PCIF0);  // Clear its interrupt flag by writing a 1.
 
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_INT6
+    // Enable INT6 on PE6 for the right encoder, triggering on any change.
+    EICRB = (EICRB & ~(3 << ISC60)) | (1 << ISC60);
+    EIFR = (1 << INTF6);  // Clear its interrupt flag by writing a 1.
+    EIMSK |= (1 << INT6);
+#else
     // Enable interrupt on PE6 for the right encoder.  We use attachInterrupt
     // instead of defining ISR(INT6_vect) ourselves so that this class will be
     // compatible with other code that uses attachInterrupt.
     attachInterrupt(4, rightISR, CHANGE);
+#endif
 
     // Initialize the variables.  It's good to do this after enabling the
     // interrupts in case the interrupts fired by accident as we were enabling
     // them.
-    lastLeftB = FastGPIO::Pin<LEFT_B>::isInputHigh();
-    lastLeftA = FastGPIO::Pin<LEFT_XOR>::isInputHigh() ^ lastLeftB;
+    uint8_t leftB = FastGPIO::Pin<LEFT_B>::isInputHigh();
+    uint8_t leftA = FastGPIO::Pin<LEFT_XOR>::isInputHigh() ^ leftB;
+    stateLeft = (leftA << 1) | leftB;
     countLeft = 0;
-    errorLeft = 0;
 
-    lastRightB = FastGPIO::Pin<RIGHT_B>::isInputHigh();
-    lastRightA = FastGPIO::Pin<RIGHT_XOR>::isInputHigh() ^ lastRightB;
+    uint8_t rightB = FastGPIO::Pin<RIGHT_B>::isInputHigh();
+    uint8_t rightA = FastGPIO::Pin<RIGHT_XOR>::isInputHigh() ^ rightB;
+    stateRight = (rightA << 1) | rightB;
     countRight = 0;
-    errorRight = 0;
 }
 
 bool Encoders::flip;
@@ -124,6 +313,9 @@ int16_t Encoders::getCountsAndResetLeft()
 
     cli();
     int16_t counts = countLeft;
+    totalLeft += (int16_t)(counts - lastLeft);
+    lastLeft = 0;
+    speedLeft.count -= counts;
     countLeft = 0;
     sei();
     return flip ? -counts : counts;
@@ -135,17 +327,146 @@ int16_t Encoders::getCountsAndResetRight()
 
     cli();
     int16_t counts = countRight;
+    totalRight += (int16_t)(counts - lastRight);
+    lastRight = 0;
+    speedRight.count -= counts;
     countRight = 0;
     sei();
     return flip ? -counts : counts;
 }
 
+EncoderSnapshot Encoders::snapshot()
+{
+    init();
+
+    EncoderSnapshot snapshot;
+
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t left = countLeft;
+    uint16_t right = countRight;
+    snapshot.time = micros();
+    totalLeft += (int16_t)(left - lastLeft);
+    totalRight += (int16_t)(right - lastRight);
+    lastLeft = left;
+    lastRight = right;
+    snapshot.left = totalLeft;
+    snapshot.right = totalRight;
+    SREG = sreg;
+
+    if (flip)
+    {
+        snapshot.left = -snapshot.left;
+        snapshot.right = -snapshot.right;
+    }
+    return snapshot;
+}
+
+static void startEdgeTiming()
+{
+    if (edgeTiming) { return; }
+
+    Timer3Clock::init();
+    uint8_t sreg = SREG;
+    cli();
+    edgeTiming = true;
+    // Make the first call look like it comes long after the last edge, so it
+    // does not use a bogus edge time.
+    uint32_t now = micros();
+    EncodersMath::resetSpeed(speedLeft, countLeft, now);
+    EncodersMath::resetSpeed(speedRight, countRight, now);
+    SREG = sreg;
+}
+
+int16_t Encoders::getSpeedLeft()
+{
+    init();
+    startEdgeTiming();
+
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t count = countLeft;
+    uint16_t edgeTicks = edgeTicksLeft;
+    uint16_t nowTicks = TCNT3;
+    uint32_t now = micros();
+    SREG = sreg;
+
+    int16_t speed = EncodersMath::computeSpeed(speedLeft, count, edgeTicks, nowTicks, now);
+    return flip ? -speed : speed;
+}
+
+int16_t Encoders::getSpeedRight()
+{
+    init();
+    startEdgeTiming();
+
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t count = countRight;
+    uint16_t edgeTicks = edgeTicksRight;
+    uint16_t nowTicks = TCNT3;
+    uint32_t now = micros();
+    SREG = sreg;
+
+    int16_t speed = EncodersMath::computeSpeed(speedRight, count, edgeTicks, nowTicks, now);
+    return flip ? -speed : speed;
+}
+
+bool Encoders::diagnosticsAvailable()
+{
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Encoders::getDiagnosticsLeft(EncoderDiagnostics & diagnostics)
+{
+    init();
+
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    cli();
+    copyDiagnostics(diagnosticsLeft, diagnostics);
+    sei();
+#else
+    diagnostics = EncoderDiagnostics();
+#endif
+}
+
+void Encoders::getDiagnosticsRight(EncoderDiagnostics & diagnostics)
+{
+    init();
+
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    cli();
+    copyDiagnostics(diagnosticsRight, diagnostics);
+    sei();
+#else
+    diagnostics = EncoderDiagnostics();
+#endif
+}
+
+void Encoders::resetDiagnostics()
+{
+    init();
+
+#ifdef POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS
+    cli();
+    clearDiagnostics(diagnosticsLeft);
+    clearDiagnostics(diagnosticsRight);
+    sei();
+#endif
+}
+
 bool Encoders::checkErrorLeft()
 {
     init();
 
-    bool error = errorLeft;
-    errorLeft = 0;
+    cli();
+    bool error = stateLeft & errorBit;
+    stateLeft &= ~errorBit;
+    sei();
     return error;
 }
 
@@ -153,8 +474,10 @@ bool Encoders::checkErrorRight()
 {
     init();
 
-    bool error = errorRight;
-    errorRight = 0;
+    cli();
+    bool error = stateRight & errorBit;
+    stateRight &= ~errorBit;
+    sei();
     return error;
 }
 
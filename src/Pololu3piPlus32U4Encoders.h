@@ -9,6 +9,53 @@
 namespace Pololu3piPlus32U4
 {
 
+/// \brief Encoder counts from both wheels captured at the same instant.
+///
+/// See Encoders::snapshot().
+struct EncoderSnapshot
+{
+    /// The total count of the left encoder.
+    int32_t left;
+
+    /// The total count of the right encoder.
+    int32_t right;
+
+    /// The value of `micros()` when the counts were captured.
+    uint32_t time;
+};
+
+/// \brief Diagnostic data about one encoder and its ISR.
+///
+/// See Encoders::getDiagnosticsLeft().
+struct EncoderDiagnostics
+{
+    /// The number of bins in #histogram.
+    static const uint8_t histogramSize = 8;
+
+    /// The number of times the ISR has run.
+    uint32_t edges;
+
+    /// The number of encoder errors (see Encoders::checkErrorLeft()).
+    uint16_t errors;
+
+    /// The shortest time between two edges, in microseconds, or 0xFFFF if
+    /// there have not been two edges yet.
+    uint16_t minInterval;
+
+    /// The total time spent in the ISR, in microseconds, not counting the
+    /// time taken to enter and leave it.
+    uint32_t busyTime;
+
+    /// A histogram of the times between edges.  Bin 0 counts intervals
+    /// shorter than 16 &micro;s, bin 1 counts intervals from 16 to 32
+    /// &micro;s, and so on, with each bin covering twice the range of the one
+    /// before, up to the last bin, which counts everything 1024 &micro;s and
+    /// longer.  Intervals too long to measure with Timer 3 (over 32.768 ms,
+    /// such as the first one after the wheel has stopped) are counted in the
+    /// last bin, and they are not used for #minInterval.
+    uint16_t histogram[histogramSize];
+};
+
 /// \brief Reads counts from the encoders on the 3pi+ 32U4.
 ///
 /// This class allows you to read counts from the encoders on the 3pi+ 32U4,
@@ -25,6 +72,16 @@ namespace Pololu3piPlus32U4
 /// [attachInterrupt()](http://arduino.cc/en/Reference/attachInterrupt), so
 /// there will be a compile-time conflict with any other code that defines an
 /// ISR for an external interrupt directly instead of using attachInterrupt().
+///
+/// Alternatively, if the library is compiled with the preprocessor macro
+/// `POLOLU_3PI_PLUS_32U4_ENCODERS_INT6` defined, this class defines an ISR for
+/// INT6_vect directly instead of calling attachInterrupt(), which saves the
+/// overhead of the Arduino interrupt dispatcher on every edge of the right
+/// encoder. In that mode, there will be a conflict with any other code that
+/// uses attachInterrupt(). The macro has to be defined for the library's
+/// source files, not just your sketch, so it must be added to the compiler
+/// flags (for example, with arduino-cli, `--build-property
+/// compiler.cpp.extra_flags=-DPOLOLU_3PI_PLUS_32U4_ENCODERS_INT6`).
 class Encoders
 {
 
@@ -87,6 +144,90 @@ public:
     /// \sa getCountsAndResetLeft()
     static int16_t getCountsAndResetRight();
 
+    /// \brief Captures the counts of both encoders at the same instant.
+    ///
+    /// \return An EncoderSnapshot with the total counts of both encoders and
+    /// a timestamp.
+    ///
+    /// Unlike getCountsLeft() and getCountsRight(), which each disable
+    /// interrupts separately and return 16-bit counts that overflow, this
+    /// function reads both counts and the time in a single short section with
+    /// interrupts disabled, so the two counts are consistent with each other
+    /// and with the timestamp, and it returns 32-bit counts that will not
+    /// overflow in practice.
+    ///
+    /// The counts are kept in 16 bits by the encoder ISRs and extended to
+    /// 32 bits here, so this function (or one of the getCountsAndReset
+    /// functions) must be called at least once per 32767 counts of either
+    /// encoder, which is several times per second at the top speed of the
+    /// Hyper edition.  The totals are not affected by
+    /// getCountsAndResetLeft() or getCountsAndResetRight().
+    ///
+    /// This function is safe to call from an interrupt.
+    static EncoderSnapshot snapshot();
+
+    /// \brief Returns the speed of the left wheel in encoder counts per
+    /// second.
+    ///
+    /// The first call to this function (or getSpeedRight()) makes the encoder
+    /// ISRs start recording the time of each encoder edge using Timer3Clock.
+    /// The speed is then computed from the number of counts since the last
+    /// call divided by the time between the first and last edges of those
+    /// counts.  At high speeds this averages over many counts like a simple
+    /// count difference, but it does not have the quantization error of
+    /// dividing by the time between calls, and at low speeds it is based on
+    /// the time between individual edges, so it updates as soon as a single
+    /// count arrives.
+    ///
+    /// When no counts have arrived since the last call, the speed is limited
+    /// to what one count in the time since the last edge would mean, so it
+    /// decays towards zero as the wheel stops, and it reads as zero once there
+    /// has been no edge for 30 ms.
+    ///
+    /// For the best results, call this function regularly, at least every
+    /// 16 ms; if the calls are further apart, it falls back to dividing the
+    /// counts by the time between calls.  Each wheel keeps its own state
+    /// between calls, so call this function from only one place in your
+    /// program (SpeedController calls it while it is running).
+    static int16_t getSpeedLeft();
+
+    /// \brief Returns the speed of the right wheel in encoder counts per
+    /// second.
+    ///
+    /// \sa getSpeedLeft()
+    static int16_t getSpeedRight();
+
+    /// \brief Returns true if the library was compiled with encoder
+    /// diagnostics enabled.
+    ///
+    /// Diagnostics are enabled by defining the preprocessor macro
+    /// `POLOLU_3PI_PLUS_32U4_ENCODERS_DIAGNOSTICS` in the compiler flags (see
+    /// the description of `POLOLU_3PI_PLUS_32U4_ENCODERS_INT6` above). They
+    /// add some time to every run of the encoder ISRs and use Timer3Clock
+    /// and its overflow interrupt, so they are off by default.
+    static bool diagnosticsAvailable();
+
+    /// \brief Gets diagnostic data about the left encoder and its ISR.
+    ///
+    /// \param[out] diagnostics The data, copied with interrupts disabled so
+    /// that it is consistent. If diagnostics are not available, this is
+    /// filled with zeros.
+    ///
+    /// This can be used to find out how much CPU time the encoder ISRs use at
+    /// a given speed (#EncoderDiagnostics::busyTime over the elapsed time), how
+    /// close together edges get (#EncoderDiagnostics::minInterval), and how
+    /// evenly spaced they are (#EncoderDiagnostics::histogram), which can
+    /// reveal a weak or damaged encoder magnet.
+    static void getDiagnosticsLeft(EncoderDiagnostics & diagnostics);
+
+    /// \brief Gets diagnostic data about the right encoder and its ISR.
+    ///
+    /// \sa getDiagnosticsLeft()
+    static void getDiagnosticsRight(EncoderDiagnostics & diagnostics);
+
+    /// \brief Clears the diagnostic data for both encoders.
+    static void resetDiagnostics();
+
     /// \brief Returns true if an error was detected on the left-side encoder.
     ///
     /// This function resets the error flag automatically, so it will only
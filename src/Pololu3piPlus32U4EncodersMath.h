@@ -0,0 +1,144 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4EncodersMath.h
+///
+/// \brief Integer math used by Encoders.
+///
+/// These functions do not access any hardware, so they can also be compiled
+/// and checked on a PC by the tests in the `extras/test` folder.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \brief The wheel speed estimator behind Encoders::getSpeedLeft() and
+/// Encoders::getSpeedRight().
+class EncodersMath
+{
+public:
+
+    /// The number of edge timer ticks per microsecond (the rate of
+    /// Timer3Clock).
+    static const uint8_t ticksPerMicrosecond = 2;
+
+    /// The time from an edge, in microseconds, after which the wheel is
+    /// considered stopped.
+    static const uint32_t speedTimeout = 30000;
+
+    /// The longest span, in microseconds, that can be measured with the edge
+    /// timer ticks before they overflow.
+    static const uint32_t maxTickSpan = 32000;
+
+    /// State kept between speed estimates for one wheel.
+    struct SpeedState
+    {
+        uint16_t count;      ///< encoder count at the last estimate
+        uint16_t edgeTicks;  ///< time of the last edge seen at the last estimate
+        uint32_t edgeAge;    ///< microseconds from that edge to the last estimate
+        uint32_t time;       ///< time of the last estimate, in microseconds
+        int16_t speed;       ///< the last estimate
+        bool edgeValid;      ///< true if edgeTicks can be used for timing
+    };
+
+    /// \brief Starts estimating from scratch.
+    ///
+    /// \param count The current encoder count.
+    /// \param now The current time in microseconds.
+    ///
+    /// The wheel is assumed to have been stopped for a long time, and the
+    /// edge time is not used until an edge has been seen.
+    static void resetSpeed(SpeedState & state, uint16_t count, uint32_t now)
+    {
+        state.count = count;
+        state.edgeTicks = 0;
+        state.edgeAge = speedTimeout;
+        state.time = now;
+        state.speed = 0;
+        state.edgeValid = false;
+    }
+
+    /// \brief Returns a new speed estimate in counts per second.
+    ///
+    /// \param count The current encoder count.
+    /// \param edgeTicks The timer ticks at the latest edge.
+    /// \param nowTicks The timer ticks now.
+    /// \param now The current time in microseconds.
+    static int16_t computeSpeed(SpeedState & state, uint16_t count,
+        uint16_t edgeTicks, uint16_t nowTicks, uint32_t now)
+    {
+        int16_t counts = count - state.count;
+        uint32_t dt = now - state.time;
+        int32_t speed;
+
+        if (counts != 0)
+        {
+            // There has been at least one edge since the last call, so the age
+            // of the latest one is at most dt, and it can be measured in ticks
+            // as long as dt is short enough.
+            uint32_t age = (dt < maxTickSpan) ?
+                (uint16_t)(nowTicks - edgeTicks) / ticksPerMicrosecond : dt;
+
+            if (state.edgeValid && state.edgeAge + dt < maxTickSpan)
+            {
+                // Counts divided by the time between the edges where they
+                // started and ended (the M/T method).
+                uint16_t span = edgeTicks - state.edgeTicks;
+                if (span == 0) { span = 1; }
+                speed = (int32_t)counts * (1000000L * ticksPerMicrosecond) / span;
+            }
+            else
+            {
+                // The previous edge is unknown or too old to time with the
+                // ticks, so divide the counts by the time since it as far as
+                // we know it.  After a stop, edgeAge is speedTimeout, so the
+                // first edge gives a low estimate instead of a spike, and the
+                // M/T method takes over at the next edge.
+                uint32_t span = state.edgeAge + dt - (age < dt ? age : 0);
+                speed = (int32_t)counts * 1000000 / (int32_t)(span ? span : 1);
+            }
+
+            state.edgeTicks = edgeTicks;
+            state.edgeAge = age;
+            state.edgeValid = (dt < maxTickSpan);
+        }
+        else
+        {
+            state.edgeAge += dt;
+            if (state.edgeAge >= maxTickSpan)
+            {
+                // The ticks of the last edge have wrapped around, so they
+                // cannot be compared with the next edge.
+                state.edgeValid = false;
+            }
+
+            if (state.edgeAge >= speedTimeout)
+            {
+                state.edgeAge = speedTimeout;
+                state.edgeValid = false;
+                speed = 0;
+            }
+            else
+            {
+                // The wheel has not moved a whole count since the last edge, so
+                // it is going no faster than one count in that time.
+                int32_t limit = 1000000 / (int32_t)(state.edgeAge ? state.edgeAge : 1);
+                speed = state.speed;
+                if (speed > limit) { speed = limit; }
+                if (speed < -limit) { speed = -limit; }
+            }
+        }
+
+        if (speed > 32767) { speed = 32767; }
+        if (speed < -32767) { speed = -32767; }
+
+        state.count = count;
+        state.time = now;
+        state.speed = speed;
+        return speed;
+    }
+};
+
+}
@@ -0,0 +1,197 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4LineFilters.h
+///
+/// \brief Filters for line sensor readings and line positions.
+///
+/// The classes in this file can be passed to the filtered versions of
+/// LineSensors::readLineBlack() and LineSensors::readLineWhite() to reduce
+/// the effect of noise on a line follower. Each filter is a small object
+/// with a fixed amount of state, so no memory is allocated, and all of the
+/// math is done with integers. Filters are chosen at compile time by their
+/// types, and several can be combined with LineFilterChain, for example:
+///
+/// ~~~{.cpp}
+/// LineFilterChain<LineMedian3Filter, LineLowPassFilter<1>, LinePositionFilter<2>> lineFilter;
+/// ~~~
+///
+/// The cycle counts given for each filter are rough estimates for one frame
+/// of five readings on the ATmega32U4 at 16 MHz, for comparison with the
+/// cost of the read itself (thousands of cycles).
+
+#pragma once
+
+#include <Pololu3piPlus32U4LineSensors.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \brief Base class for line filters that leaves everything unchanged.
+///
+/// A filter stage provides two functions: filterReadings(), which filters
+/// the calibrated readings in place, and filterPosition(), which filters the
+/// line position computed from them. Filters derived from this class only
+/// need to override the one they use.
+class LineFilterStage
+{
+public:
+  /// \brief Filters calibrated sensor readings in place.
+  void filterReadings(uint16_t * sensorValues) { (void)sensorValues; }
+
+  /// \brief Filters a line position.
+  uint16_t filterPosition(uint16_t position) { return position; }
+};
+
+/// \brief Replaces each reading with the median of its last three values.
+///
+/// This removes single-frame spikes completely while delaying real changes
+/// by only one frame. It uses 21 bytes of RAM and takes roughly 150 cycles
+/// per frame.
+class LineMedian3Filter : public LineFilterStage
+{
+public:
+  /// \brief Filters calibrated sensor readings in place.
+  void filterReadings(uint16_t * sensorValues)
+  {
+    if (!primed)
+    {
+      for (uint8_t i = 0; i < LineSensors::_sensorCount; i++)
+      {
+        older[i] = sensorValues[i];
+        old[i] = sensorValues[i];
+      }
+      primed = true;
+    }
+
+    for (uint8_t i = 0; i < LineSensors::_sensorCount; i++)
+    {
+      uint16_t a = older[i];
+      uint16_t b = old[i];
+      uint16_t c = sensorValues[i];
+      older[i] = b;
+      old[i] = c;
+
+      // median = max(min(a, b), min(max(a, b), c))
+      uint16_t low = a < b ? a : b;
+      uint16_t high = a < b ? b : a;
+      uint16_t median = high < c ? high : c;
+      sensorValues[i] = low > median ? low : median;
+    }
+  }
+
+private:
+  bool primed = false;
+  uint16_t older[LineSensors::_sensorCount];
+  uint16_t old[LineSensors::_sensorCount];
+};
+
+/// \brief Smooths each reading with a first-order low-pass (IIR) filter.
+///
+/// \tparam shift How much smoothing to apply: each output moves
+/// 1/2<sup>shift</sup> of the way from the previous output to the new
+/// reading. Must be at most 6.
+///
+/// This filter is meant for calibrated readings, which are at most 1000; the
+/// state is kept scaled up by 2<sup>shift</sup> so that small changes are
+/// not lost to rounding. It uses 11 bytes of RAM and takes roughly 60
+/// cycles plus 20 cycles per unit of \p shift per frame.
+template <uint8_t shift>
+class LineLowPassFilter : public LineFilterStage
+{
+  static_assert(shift <= 6, "LineLowPassFilter shift must be at most 6");
+
+public:
+  /// \brief Filters calibrated sensor readings in place.
+  void filterReadings(uint16_t * sensorValues)
+  {
+    if (!primed)
+    {
+      for (uint8_t i = 0; i < LineSensors::_sensorCount; i++)
+      {
+        state[i] = sensorValues[i] << shift;
+      }
+      primed = true;
+    }
+
+    for (uint8_t i = 0; i < LineSensors::_sensorCount; i++)
+    {
+      state[i] = state[i] - (state[i] >> shift) + sensorValues[i];
+      sensorValues[i] = state[i] >> shift;
+    }
+  }
+
+private:
+  bool primed = false;
+  uint16_t state[LineSensors::_sensorCount];
+};
+
+/// \brief Smooths the line position with a first-order low-pass (IIR)
+/// filter.
+///
+/// \tparam shift How much smoothing to apply: each output moves
+/// 1/2<sup>shift</sup> of the way from the previous output to the new
+/// position. Must be at most 4.
+///
+/// This filter takes noise out of the position before it reaches the
+/// derivative term of a PID controller. It uses 3 bytes of RAM and takes
+/// roughly 15 cycles plus 4 cycles per unit of \p shift per frame.
+template <uint8_t shift>
+class LinePositionFilter : public LineFilterStage
+{
+  static_assert(shift <= 4, "LinePositionFilter shift must be at most 4");
+
+public:
+  /// \brief Filters a line position.
+  uint16_t filterPosition(uint16_t position)
+  {
+    if (!primed)
+    {
+      state = position << shift;
+      primed = true;
+    }
+
+    state = state - (state >> shift) + position;
+    return state >> shift;
+  }
+
+private:
+  bool primed = false;
+  uint16_t state;
+};
+
+/// \brief Applies several line filters in order.
+///
+/// \tparam Stages The filter classes to apply, in order. Readings are
+/// filtered by every stage before the position is computed, and then the
+/// position is filtered by every stage.
+template <class... Stages>
+class LineFilterChain;
+
+/// \cond
+template <>
+class LineFilterChain<> : public LineFilterStage
+{
+};
+
+template <class First, class... Rest>
+class LineFilterChain<First, Rest...>
+{
+public:
+  void filterReadings(uint16_t * sensorValues)
+  {
+    first.filterReadings(sensorValues);
+    rest.filterReadings(sensorValues);
+  }
+
+  uint16_t filterPosition(uint16_t position)
+  {
+    return rest.filterPosition(first.filterPosition(position));
+  }
+
+private:
+  First first;
+  LineFilterChain<Rest...> rest;
+};
+/// \endcond
+
+}
@@ -1,26 +1,151 @@
 // Copyright (C) Pololu Corporation.  See www.pololu.com for details.
 
 #include <Pololu3piPlus32U4LineSensors.h>
+#include <Pololu3piPlus32U4LineSensorsMath.h>
+#include <Pololu3piPlus32U4SensorArrays.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
 
 namespace Pololu3piPlus32U4
 {
 
 void LineSensors::setTimeout(uint16_t timeout)
 {
-  if (timeout > 32767) { timeout = 32767; }
+  if (timeout > 32000) { timeout = 32000; }
   _timeout = timeout;
   _maxValue = timeout;
 }
 
+uint16_t LineSensors::autoTuneTimeout(uint8_t marginPercentage)
+{
+  if (!calibrationOn.initialized) { return _timeout; }
+
+  uint16_t darkest = 0;
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    if (calibrationOn.maximum[i] > darkest) { darkest = calibrationOn.maximum[i]; }
+  }
+
+  uint32_t timeout = darkest + (uint32_t)darkest * marginPercentage / 100;
+  if (timeout == 0 || timeout >= _timeout) { return _timeout; }
+
+  setTimeout(timeout);
+
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    if (calibrationOn.minimum[i] > _timeout)  { calibrationOn.minimum[i] = _timeout; }
+    if (calibrationOn.maximum[i] > _timeout)  { calibrationOn.maximum[i] = _timeout; }
+    if (calibrationOff.minimum[i] > _timeout) { calibrationOff.minimum[i] = _timeout; }
+    if (calibrationOff.maximum[i] > _timeout) { calibrationOff.maximum[i] = _timeout; }
+  }
+  updateReciprocals(calibrationOn, _reciprocalsOn);
+  updateReciprocals(calibrationOff, _reciprocalsOff);
+
+  return _timeout;
+}
+
+uint16_t LineSensors::getMaxReadRate()
+{
+  // Each read also spends 10 us charging the sensors.
+  return 1000000 / (10 + (uint32_t)_timeout);
+}
+
 void LineSensors::resetCalibration()
 {
   for (uint8_t i = 0; i < _sensorCount; i++)
   {
-    if (calibrationOn.maximum)   { calibrationOn.maximum[i] = 0; }
-    if (calibrationOff.maximum)  { calibrationOff.maximum[i] = 0; }
-    if (calibrationOn.minimum)   { calibrationOn.minimum[i] = _maxValue; }
-    if (calibrationOff.minimum)  { calibrationOff.minimum[i] = _maxValue; }
+    calibrationOn.maximum[i] = 0;
+    calibrationOff.maximum[i] = 0;
+    calibrationOn.minimum[i] = _maxValue;
+    calibrationOff.minimum[i] = _maxValue;
+  }
+
+  updateReciprocals(calibrationOn, _reciprocalsOn);
+  updateReciprocals(calibrationOff, _reciprocalsOff);
+}
+
+// Layout of the calibration data saved in EEPROM by saveCalibration().  The
+// version should be incremented whenever this layout changes.
+static const uint8_t calibrationRecordMagic = 0x3B;
+static const uint8_t calibrationRecordVersion = 1;
+
+struct CalibrationRecord
+{
+  uint8_t magic;
+  uint8_t version;
+  uint8_t sensorCount;
+  uint8_t initialized;  // bit 0: calibrationOn, bit 1: calibrationOff
+  uint16_t timeout;
+  uint16_t onMinimum[LineSensors::_sensorCount];
+  uint16_t onMaximum[LineSensors::_sensorCount];
+  uint16_t offMinimum[LineSensors::_sensorCount];
+  uint16_t offMaximum[LineSensors::_sensorCount];
+  uint16_t crc;  // CRC-CCITT of everything above
+};
+
+static_assert(sizeof(CalibrationRecord) == LineSensors::calibrationRecordSize,
+  "calibrationRecordSize does not match the record layout");
+
+static uint16_t calibrationRecordCrc(const CalibrationRecord & record)
+{
+  const uint8_t * bytes = (const uint8_t *)&record;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < sizeof(record) - sizeof(record.crc); i++)
+  {
+    crc = _crc_ccitt_update(crc, bytes[i]);
   }
+  return crc;
+}
+
+void LineSensors::saveCalibration(uint16_t address)
+{
+  CalibrationRecord record;
+  record.magic = calibrationRecordMagic;
+  record.version = calibrationRecordVersion;
+  record.sensorCount = _sensorCount;
+  record.initialized = calibrationOn.initialized | (calibrationOff.initialized << 1);
+  record.timeout = _timeout;
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    record.onMinimum[i] = calibrationOn.minimum[i];
+    record.onMaximum[i] = calibrationOn.maximum[i];
+    record.offMinimum[i] = calibrationOff.minimum[i];
+    record.offMaximum[i] = calibrationOff.maximum[i];
+  }
+  record.crc = calibrationRecordCrc(record);
+
+  eeprom_update_block(&record, (void *)address, sizeof(record));
+}
+
+bool LineSensors::loadCalibration(uint16_t address)
+{
+  CalibrationRecord record;
+  eeprom_read_block(&record, (const void *)address, sizeof(record));
+
+  if (record.magic != calibrationRecordMagic ||
+    record.version != calibrationRecordVersion ||
+    record.sensorCount != _sensorCount ||
+    record.crc != calibrationRecordCrc(record))
+  {
+    return false;
+  }
+
+  // The readings are only comparable with ones taken with the same timeout,
+  // which may have been set by autoTuneTimeout() before saving.
+  setTimeout(record.timeout);
+  calibrationOn.initialized = record.initialized & 1;
+  calibrationOff.initialized = (record.initialized >> 1) & 1;
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    calibrationOn.minimum[i] = record.onMinimum[i];
+    calibrationOn.maximum[i] = record.onMaximum[i];
+    calibrationOff.minimum[i] = record.offMinimum[i];
+    calibrationOff.maximum[i] = record.offMaximum[i];
+  }
+
+  updateReciprocals(calibrationOn, _reciprocalsOn);
+  updateReciprocals(calibrationOff, _reciprocalsOff);
+  return true;
 }
 
 void LineSensors::calibrate(LineSensorsReadMode mode)
@@ -33,6 +158,12 @@ void LineSensors::calibrate(LineSensorsReadMode mode)
     calibrateOnOrOff(calibrationOn, LineSensorsReadMode::On);
   }
 
+  // differential readings are calibrated like readings with the emitters on
+  if (mode == LineSensorsReadMode::Differential)
+  {
+    calibrateOnOrOff(calibrationOn, LineSensorsReadMode::Differential);
+  }
+
   if (mode == LineSensorsReadMode::Off)
   {
     calibrateOnOrOff(calibrationOff, LineSensorsReadMode::Off);
@@ -45,29 +176,9 @@ void LineSensors::calibrateOnOrOff(CalibrationData & calibration, LineSensorsRea
   uint16_t maxSensorValues[_sensorCount];
   uint16_t minSensorValues[_sensorCount];
 
-  // (Re)allocate and initialize the arrays if necessary.
+  // Initialize the arrays if necessary.
   if (!calibration.initialized)
   {
-    uint16_t * oldMaximum = calibration.maximum;
-    calibration.maximum = (uint16_t *)realloc(calibration.maximum,
-                                              sizeof(uint16_t) * _sensorCount);
-    if (calibration.maximum == nullptr)
-    {
-      // Memory allocation failed; don't continue.
-      free(oldMaximum); // deallocate any memory used by old array
-      return;
-    }
-
-    uint16_t * oldMinimum = calibration.minimum;
-    calibration.minimum = (uint16_t *)realloc(calibration.minimum,
-                                              sizeof(uint16_t) * _sensorCount);
-    if (calibration.minimum == nullptr)
-    {
-      // Memory allocation failed; don't continue.
-      free(oldMinimum); // deallocate any memory used by old array
-      return;
-    }
-
     // Initialize the max and min calibrated values to values that
     // will cause the first reading to update them.
     for (uint8_t i = 0; i < _sensorCount; i++)
@@ -116,30 +227,128 @@ void LineSensors::calibrateOnOrOff(CalibrationData & calibration, LineSensorsRea
       calibration.minimum[i] = maxSensorValues[i];
     }
   }
+
+  updateReciprocals(calibration,
+    (mode == LineSensorsReadMode::Off) ? _reciprocalsOff : _reciprocalsOn);
 }
 
 void LineSensors::read(uint16_t * sensorValues, LineSensorsReadMode mode)
 {
+  uint32_t timestamp = 0;
+  if (_frameLog) { timestamp = micros(); }
+
   switch (mode)
   {
     case LineSensorsReadMode::Off:
       emittersOff();
       readPrivate(sensorValues);
-      return;
+      break;
 
     case LineSensorsReadMode::Manual:
       readPrivate(sensorValues);
-      return;
+      break;
 
     case LineSensorsReadMode::On:
       emittersOn();
       readPrivate(sensorValues);
       emittersOff();
-      return;
+      break;
+
+    case LineSensorsReadMode::Differential:
+      readDifferential(sensorValues);
+      break;
 
     default: // invalid - do nothing
       return;
   }
+
+  if (_frameLog)
+  {
+    _frameLog->push(sensorValues, mode, timestamp, _lastReadDuration);
+  }
+}
+
+void LineSensorsFrameLog::push(const uint16_t * sensorValues,
+  LineSensorsReadMode mode, uint32_t timestamp, uint16_t duration)
+{
+  LineSensorsFrame & frame = frames[head];
+  frame.timestamp = timestamp;
+  frame.duration = duration;
+  frame.mode = mode;
+  for (uint8_t i = 0; i < LineSensors::_sensorCount; i++)
+  {
+    frame.values[i] = sensorValues[i];
+  }
+
+  if (++head == capacity) { head = 0; }
+  if (count < capacity) { count++; }
+  else { overwritten++; }
+}
+
+bool LineSensorsFrameLog::pop(LineSensorsFrame & frame)
+{
+  if (count == 0) { return false; }
+
+  uint8_t tail = (head >= count) ? head - count : head + capacity - count;
+  frame = frames[tail];
+  count--;
+  return true;
+}
+
+void LineSensorsFrameLog::clear()
+{
+  head = 0;
+  count = 0;
+  overwritten = 0;
+}
+
+void LineSensors::readDifferential(uint16_t * sensorValues)
+{
+  // The subtraction below magnifies any error in the ambient reading when it
+  // is close to the emitters-on reading, so take it with a blocking read,
+  // which times each sensor more finely than a background read.  Doing it right
+  // before the emitters-on reading also keeps the two close together in
+  // time.  In bright ambient light, where this mode matters, the sensors
+  // fall quickly, so the extra read is short.
+  uint16_t ambient[_sensorCount];
+  emittersOff();
+  readPrivate(ambient);
+
+  emittersOn();
+  readPrivate(sensorValues);
+  emittersOff();
+
+  // Each RC discharge time is inversely proportional to the light reaching
+  // the sensor, so the ambient light is removed by subtracting the
+  // reciprocals of the two times (1/on - 1/off) and converting back.  The
+  // result is the time the sensor would have taken with only the emitter
+  // light, limited to the timeout.
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    uint16_t on = sensorValues[i];
+    uint16_t off = ambient[i];
+
+    if (off >= _timeout)
+    {
+      // too little ambient light to measure; keep the reading as it is
+    }
+    else if (on >= off)
+    {
+      // no reflected emitter light at all
+      sensorValues[i] = _timeout;
+    }
+    else
+    {
+      sensorValues[i] = LineSensorsMath::removeAmbient(on, off, _timeout);
+    }
+  }
+}
+
+void LineSensors::setAsyncSamplePeriod(uint8_t period)
+{
+  // Shorter periods would leave almost no time between interrupts.
+  if (period < 8) { period = 8; }
+  _asyncSamplePeriod = period;
 }
 
 void LineSensors::readCalibrated(uint16_t * sensorValues, LineSensorsReadMode mode)
@@ -149,7 +358,7 @@ void LineSensors::readCalibrated(uint16_t * sensorValues, LineSensorsReadMode mo
 
   // if not calibrated, do nothing
 
-  if (mode == LineSensorsReadMode::On)
+  if (mode == LineSensorsReadMode::On || mode == LineSensorsReadMode::Differential)
   {
     if (!calibrationOn.initialized)
     {
@@ -168,49 +377,164 @@ void LineSensors::readCalibrated(uint16_t * sensorValues, LineSensorsReadMode mo
   // read the needed values
   read(sensorValues, mode);
 
-  for (uint8_t i = 0; i < _sensorCount; i++)
+  if (_trackingEnabled && mode != LineSensorsReadMode::Off)
   {
-    uint16_t calmin, calmax;
+    trackCalibration(sensorValues);
+  }
+
+  applyCalibration(sensorValues, mode);
+}
 
-    // find the correct calibration
-    if (mode == LineSensorsReadMode::On)
+void LineSensors::applyCalibration(uint16_t * sensorValues, LineSensorsReadMode mode)
+{
+  // manual emitter control is not supported
+  if (mode == LineSensorsReadMode::Manual) { return; }
+
+  const CalibrationData & calibration =
+    (mode == LineSensorsReadMode::Off) ? calibrationOff : calibrationOn;
+  CalibrationReciprocals & reciprocals =
+    (mode == LineSensorsReadMode::Off) ? _reciprocalsOff : _reciprocalsOn;
+  bool tracked = _trackingEnabled && mode != LineSensorsReadMode::Off;
+
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    uint16_t calmin = calibration.minimum[i];
+    uint16_t denominator = calibration.maximum[i] - calmin;
+
+    // The calibration arrays are public, so pick up any changes made to them
+    // since the reciprocal was computed.  While tracking is moving the
+    // calibration a little at a time, keep using the old range until the
+    // change is big enough to matter, so that the division does not have to
+    // be redone on every read.
+    uint16_t computed = reciprocals.denominator[i];
+    if (denominator != computed)
     {
-      calmax = calibrationOn.maximum[i];
-      calmin = calibrationOn.minimum[i];
+      uint16_t change = (denominator > computed) ?
+        denominator - computed : computed - denominator;
+      if (tracked && change <= (computed >> 6))
+      {
+        denominator = computed;
+      }
+      else
+      {
+        updateReciprocal(reciprocals, i, denominator);
+      }
     }
-    else if (mode == LineSensorsReadMode::Off)
+
+    sensorValues[i] = LineSensorsMath::scaleReading(sensorValues[i], calmin,
+                                                    denominator, reciprocals.factor[i]);
+  }
+}
+
+void LineSensors::setCalibrationTracking(bool enable, uint8_t shift)
+{
+  if (shift > 15) { shift = 15; }
+  _trackingShift = shift;
+
+  if (enable && !_trackingEnabled)
+  {
+    _trackingCount = 0;
+    for (uint8_t i = 0; i < _sensorCount; i++)
     {
-      calmax = calibrationOff.maximum[i];
-      calmin = calibrationOff.minimum[i];
+      calibrationDrift.minimum[i] = 0;
+      calibrationDrift.maximum[i] = 0;
     }
+  }
+  _trackingEnabled = enable;
+}
 
-    uint16_t denominator = calmax - calmin;
-    int16_t value = 0;
+// Returns the amount to move a calibration value by to cover 1/2^shift of
+// the given distance to a reading outside of the range, rounded up so that a
+// reading that stays outside is eventually reached.
+static uint16_t widenStep(uint16_t distance, uint8_t shift)
+{
+  return ((uint32_t)distance + ((uint16_t)1 << shift) - 1) >> shift;
+}
+
+// Moves each sensor's minimum or maximum 1/2^shift of the way toward a
+// reading outside of the calibrated range (a fixed-point decay, so a single
+// glitch moves it only a little), and once every 2^shift reads, moves the
+// minimum or maximum (whichever is on the same side of the middle as the
+// reading) 1 us toward a reading inside it.  The minimum can never pass the
+// maximum.
+void LineSensors::trackCalibration(const uint16_t * sensorValues)
+{
+  bool narrow = false;
+  if (++_trackingCount >= ((uint16_t)1 << _trackingShift))
+  {
+    _trackingCount = 0;
+    narrow = true;
+  }
 
-    if (denominator != 0)
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    uint16_t & calmin = calibrationOn.minimum[i];
+    uint16_t & calmax = calibrationOn.maximum[i];
+    if (calmax <= calmin) { continue; }
+
+    uint16_t value = sensorValues[i];
+    if (value > calmax)
+    {
+      uint16_t step = widenStep(value - calmax, _trackingShift);
+      calibrationDrift.maximum[i] += step;
+      calmax += step;
+    }
+    else if (value < calmin)
     {
-      value = (((int32_t)sensorValues[i]) - calmin) * 1000 / denominator;
+      uint16_t step = widenStep(calmin - value, _trackingShift);
+      calibrationDrift.minimum[i] -= step;
+      calmin -= step;
     }
+    else if (narrow)
+    {
+      uint16_t middle = calmin + (calmax - calmin) / 2;
+      if (value >= middle)
+      {
+        if (value < calmax) { calmax--; calibrationDrift.maximum[i]--; }
+      }
+      else
+      {
+        if (value > calmin) { calmin++; calibrationDrift.minimum[i]++; }
+      }
+    }
+  }
+}
 
-    if (value < 0) { value = 0; }
-    else if (value > 1000) { value = 1000; }
+void LineSensors::updateReciprocals(const CalibrationData & calibration,
+                                    CalibrationReciprocals & reciprocals)
+{
+  if (!calibration.initialized) { return; }
 
-    sensorValues[i] = value;
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    updateReciprocal(reciprocals, i, calibration.maximum[i] - calibration.minimum[i]);
   }
 }
 
+void LineSensors::updateReciprocal(CalibrationReciprocals & reciprocals,
+                                   uint8_t i, uint16_t denominator)
+{
+  reciprocals.denominator[i] = denominator;
+  reciprocals.factor[i] = LineSensorsMath::reciprocal(denominator);
+}
+
 uint16_t LineSensors::readLinePrivate(uint16_t * sensorValues, LineSensorsReadMode mode,
                          bool invertReadings)
 {
-  bool onLine = false;
-  uint32_t avg = 0; // this is for the weighted total
-  uint16_t sum = 0; // this is for the denominator, which is <= 64000
-
   // manual emitter control is not supported
   if (mode == LineSensorsReadMode::Manual) { return 0; }
 
   readCalibrated(sensorValues, mode);
 
+  return linePosition(sensorValues, invertReadings);
+}
+
+uint16_t LineSensors::linePosition(const uint16_t * sensorValues, bool invertReadings)
+{
+  bool onLine = false;
+  uint32_t avg = 0; // this is for the weighted total
+  uint16_t sum = 0; // this is for the denominator, which is <= 64000
+
   for (uint8_t i = 0; i < _sensorCount; i++)
   {
     uint16_t value = sensorValues[i];
@@ -245,57 +569,89 @@ uint16_t LineSensors::readLinePrivate(uint16_t * sensorValues, LineSensorsReadMo
   return _lastPosition;
 }
 
-// the destructor frees up allocated memory
-LineSensors::~LineSensors()
+LineEstimate LineSensors::readLineEstimatePrivate(uint16_t * sensorValues,
+  LineSensorsReadMode mode, bool invertReadings)
 {
-  if (calibrationOn.maximum)  { free(calibrationOn.maximum); }
-  if (calibrationOff.maximum) { free(calibrationOff.maximum); }
-  if (calibrationOn.minimum)  { free(calibrationOn.minimum); }
-  if (calibrationOff.minimum) { free(calibrationOff.minimum); }
-}
+  LineEstimate estimate = { 0, 0, 0, 0 };
 
-void LineSensors::readPrivate(uint16_t * sensorValues)
-{
-  FastGPIO::Pin<line0Pin>::setOutputHigh();
-  FastGPIO::Pin<line1Pin>::setOutputHigh();
-  FastGPIO::Pin<line2Pin>::setOutputHigh();
-  FastGPIO::Pin<line3Pin>::setOutputHigh();
-  FastGPIO::Pin<line4Pin>::setOutputHigh();
-  _delay_us(10);
-
-  sensorValues[0] = _timeout;
-  sensorValues[1] = _timeout;
-  sensorValues[2] = _timeout;
-  sensorValues[3] = _timeout;
-  sensorValues[4] = _timeout;
-
-  noInterrupts();
-  uint16_t startTime = micros();
-  FastGPIO::Pin<line0Pin>::setInput();
-  FastGPIO::Pin<line1Pin>::setInput();
-  FastGPIO::Pin<line2Pin>::setInput();
-  FastGPIO::Pin<line3Pin>::setInput();
-  FastGPIO::Pin<line4Pin>::setInput();
-  interrupts();
-
-  uint16_t time = 0;
-  while (true)
+  // manual emitter control is not supported
+  if (mode == LineSensorsReadMode::Manual) { return estimate; }
+
+  readCalibrated(sensorValues, mode);
+
+  uint32_t avg = 0;  // weighted total for the fallback position
+  uint16_t sum = 0;  // total of the values above the noise threshold
+  uint16_t peak = 0;
+  uint16_t low = 1000;
+  uint8_t peakIndex = 0;
+  uint8_t lineMask = 0;  // bit i is set if sensor i sees the line
+
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    uint16_t value = sensorValues[i];
+    if (invertReadings) { value = 1000 - value; }
+
+    if (value > peak) { peak = value; peakIndex = i; }
+    if (value < low) { low = value; }
+    if (value > 500) { lineMask |= 1 << i; }
+
+    // only average in values that are above a noise threshold
+    if (value > 50)
+    {
+      avg += (uint32_t)value * (i * 1000);
+      sum += value;
+    }
+  }
+
+  // Same test as readLinePrivate(): the line is seen if any value is above 200.
+  if (peak <= 200)
+  {
+    estimate.position = (_lastPosition < (_sensorCount - 1) * 1000 / 2) ?
+      0 : (_sensorCount - 1) * 1000;
+    return estimate;
+  }
+
+  if (peakIndex > 0 && peakIndex < _sensorCount - 1)
   {
-    noInterrupts();
-    time = micros() - startTime;
-    if (time >= _timeout)
+    // Fit a parabola through the peak and its neighbors; its vertex is
+    // (a - c) / (2 * (a - 2b + c)) sensor spacings from the peak, which is
+    // always within half a spacing because b is the highest of the three.
+    int16_t a = sensorValues[peakIndex - 1];
+    int16_t b = sensorValues[peakIndex];
+    int16_t c = sensorValues[peakIndex + 1];
+    if (invertReadings) { a = 1000 - a; b = 1000 - b; c = 1000 - c; }
+
+    int16_t curvature = a - 2 * b + c;
+    int16_t offset = 0;
+    if (curvature != 0)
     {
-      interrupts();
-      break;
+      offset = (int32_t)500 * (a - c) / curvature;
     }
-    if (!FastGPIO::Pin<line0Pin>::isInputHigh() && time < sensorValues[0]) { sensorValues[0] = time; }
-    if (!FastGPIO::Pin<line1Pin>::isInputHigh() && time < sensorValues[1]) { sensorValues[1] = time; }
-    if (!FastGPIO::Pin<line2Pin>::isInputHigh() && time < sensorValues[2]) { sensorValues[2] = time; }
-    if (!FastGPIO::Pin<line3Pin>::isInputHigh() && time < sensorValues[3]) { sensorValues[3] = time; }
-    if (!FastGPIO::Pin<line4Pin>::isInputHigh() && time < sensorValues[4]) { sensorValues[4] = time; }
-    interrupts();
-    __builtin_avr_delay_cycles(4);  // allow interrupts to run
+    estimate.position = peakIndex * 1000 + offset;
   }
+  else
+  {
+    estimate.position = avg / sum;
+  }
+  _lastPosition = estimate.position;
+
+  estimate.width = (uint32_t)sum * 1000 / peak;
+  estimate.confidence = peak - low;
+
+  const uint8_t allMask = (1 << _sensorCount) - 1;
+  const uint8_t centerMask = 1 << (_sensorCount / 2);
+  const uint8_t leftMask = (centerMask << 1) - 1;     // sensors 0 to center
+  const uint8_t rightMask = allMask & ~(centerMask - 1); // center to last
+  if ((lineMask & leftMask) == leftMask)   { estimate.flags |= LineBranchLeft; }
+  if ((lineMask & rightMask) == rightMask) { estimate.flags |= LineBranchRight; }
+  if (lineMask == allMask)                 { estimate.flags |= LineCross; }
+
+  return estimate;
+}
+
+void LineSensors::readPrivate(uint16_t * sensorValues)
+{
+  _lastReadDuration = LineArray::read(sensorValues, _timeout);
 }
 
 }
@@ -24,9 +24,80 @@ enum class LineSensorsReadMode : uint8_t {
   /// the emitters: they are left in their existing states, which allows manual
   /// control of the emitters for testing and advanced use. Calibrating and
   /// obtaining calibrated readings are not supported with this mode.
-  Manual
+  Manual,
+
+  /// Each reading is made with the emitters on, and then the ambient light
+  /// measured by an emitters-off reading is removed from it, so the result
+  /// is a measure of reflectance that is not affected by room lighting.
+  ///
+  /// The emitters-off reading is taken right before each emitters-on
+  /// reading. In bright light the sensors fall quickly, so it adds little
+  /// to the time each read takes; in the dark it can take up to the
+  /// timeout, but then there is no ambient light to remove. Readings in this
+  /// mode use the same calibration data as LineSensorsReadMode::On
+  /// (#LineSensors::calibrationOn), so you should also calibrate with this
+  /// mode.
+  Differential
 };
 
+/// Line features that can be reported in LineEstimate::flags.
+enum LineFeature {
+  /// The line extends from the center to the leftmost sensor, as it does at
+  /// a branch or turn to the left.
+  LineBranchLeft  = 1 << 0,
+
+  /// The line extends from the center to the rightmost sensor, as it does at
+  /// a branch or turn to the right.
+  LineBranchRight = 1 << 1,
+
+  /// Every sensor sees the line, as it does at a crossing line (both of the
+  /// branch flags are also set).
+  LineCross       = 1 << 2
+};
+
+/// \brief Describes the line under the sensors in more detail than a
+/// position alone.
+///
+/// See LineSensors::readLineEstimateBlack().
+struct LineEstimate
+{
+  /// Estimated line position from 0 to 4000, like the value returned by
+  /// LineSensors::readLineBlack(), but refined by fitting a parabola through
+  /// the strongest reading and its two neighbors.
+  uint16_t position;
+
+  /// Estimated width of the line in the same units as #position (1000 is
+  /// the spacing between two sensors), or 0 if no line was seen.
+  uint16_t width;
+
+  /// How clearly the line stands out from the background, from 0 (no line
+  /// seen) to 1000.
+  uint16_t confidence;
+
+  /// A bit field of ::LineFeature flags.
+  uint8_t flags;
+};
+
+/// \brief Stores sensor calibration data.
+///
+/// \tparam sensorCount The number of sensors to store calibration data for.
+///
+/// The arrays are sized at compile time, so calibration never needs to
+/// allocate memory. See LineSensors::calibrate() and
+/// LineSensors::readCalibrated() for details.
+template <uint8_t sensorCount>
+struct LineSensorsCalibrationData
+{
+  /// Whether the arrays have been initialized by calibration.
+  bool initialized = false;
+  /// Lowest readings seen during calibration.
+  uint16_t minimum[sensorCount];
+  /// Highest readings seen during calibration.
+  uint16_t maximum[sensorCount];
+};
+
+class LineSensorsFrameLog;
+
 /// \brief Gets readings from the five reflectance sensors on the bottom of the
 /// 3pi+ 32U4.
 ///
@@ -42,6 +113,9 @@ public:
   /// Default timeout for RC sensors (in microseconds).
   static const uint16_t defaultTimeout = 4000;
 
+  /// Default sampling period for background reads (in microseconds).
+  static const uint8_t defaultAsyncSamplePeriod = 32;
+
   static const uint8_t emitterPin = 11;
   static const uint8_t line0Pin = 12;
   static const uint8_t line1Pin = A0;
@@ -49,8 +123,6 @@ public:
   static const uint8_t line3Pin = A3;
   static const uint8_t line4Pin = A4;
 
-  ~LineSensors();
-
   /// \brief Sets the timeout for RC sensors.
   ///
   /// \param timeout The length of time, in microseconds, beyond which you
@@ -64,7 +136,8 @@ public:
   /// sensor-reading cycle while maintaining useful measurements of
   /// reflectance. The default timeout is 4000 &micro;s.
   ///
-  /// The maximum allowed timeout is 32767.
+  /// The maximum allowed timeout is 32000, which leaves startRead() some
+  /// margin before its 16-bit Timer 3 count overflows.
   void setTimeout(uint16_t timeout);
 
   /// \brief Returns the timeout.
@@ -74,6 +147,51 @@ public:
   /// See also setTimeout().
   uint16_t getTimeout() { return _timeout; }
 
+  /// \brief Shortens the timeout to fit the calibrated readings.
+  ///
+  /// \param marginPercentage How much longer than the darkest calibrated
+  /// reading the new timeout should be, as a percentage of that reading.
+  /// The default is 25.
+  ///
+  /// \return The new timeout in microseconds.
+  ///
+  /// The default timeout is usually much longer than the darkest reading on
+  /// a real course, and every read of a dark surface has to wait for it.
+  /// This method finds the highest maximum in #calibrationOn, adds the
+  /// margin, and makes that the new timeout if it is shorter than the
+  /// current one. Stored calibration values above the new timeout (for
+  /// example, emitters-off readings that had timed out) are limited to it,
+  /// so that they stay consistent with readings taken from now on.
+  ///
+  /// You should call this after calibrating with the emitters on (or in
+  /// LineSensorsReadMode::Differential), and only when the calibration
+  /// sweep has passed every sensor over the darkest part of the course. If
+  /// there is no such calibration data, the timeout is left unchanged.
+  ///
+  /// See also getMaxReadRate().
+  uint16_t autoTuneTimeout(uint8_t marginPercentage = 25);
+
+  /// \brief Returns the maximum number of reads per second.
+  ///
+  /// \return The number of reads per second that the current timeout
+  /// allows if every read lasts until the timeout.
+  ///
+  /// Reads usually end earlier than that (see getLastReadDuration()), so
+  /// this is a lower bound on the read rate you can expect.
+  uint16_t getMaxReadRate();
+
+  /// \brief Returns the duration of the most recent sensor read.
+  ///
+  /// \return The time, in microseconds, from releasing the sensors until
+  /// either all of them had fallen or the timeout was reached.
+  ///
+  /// A read ends as soon as every sensor has been timed, so over a light
+  /// surface this is usually much shorter than the timeout. You can use it
+  /// to measure how many reads per second your course allows. Both read()
+  /// (and the other reading functions built on it) and getReadings() update
+  /// this value.
+  uint16_t getLastReadDuration() { return _lastReadDuration; }
+
   /// \brief Reads the sensors for calibration.
   ///
   /// \param mode The emitter behavior during calibration, as a member of
@@ -85,17 +203,16 @@ public:
   /// and minimum values found over time are stored in #calibrationOn and/or
   /// #calibrationOff for use by the readCalibrated() method.
   ///
-  /// If the storage for the calibration values has not been initialized,
-  /// this function will (re)allocate the arrays and initialize the maximum
-  /// and minimum values to 0 and the maximum possible sensor reading,
-  /// respectively, so that the very first calibration sensor reading will
-  /// update both of them.
+  /// If the calibration values have not been initialized, this function
+  /// will initialize the maximum and minimum values to 0 and the maximum
+  /// possible sensor reading, respectively, so that the very first
+  /// calibration sensor reading will update both of them.
   ///
-  /// Note that the `minimum` and `maximum` pointers in the CalibrationData
-  /// structs will point to arrays of length five,
-  /// and they will only be allocated when calibrate() is
-  /// called. If you only calibrate with the emitters on, the calibration
-  /// arrays that hold the off values will not be allocated (and vice versa).
+  /// Note that the `minimum` and `maximum` arrays in the CalibrationData
+  /// structs have a length of five and are always present, but they only
+  /// hold meaningful values once `initialized` is true. If you only
+  /// calibrate with the emitters on, the calibration arrays that hold the
+  /// off values will stay uninitialized (and vice versa).
   ///
   /// \if usage
   ///   See \ref md_usage for more information and example code.
@@ -105,6 +222,46 @@ public:
   /// \brief Resets all calibration that has been done.
   void resetCalibration();
 
+  /// The number of bytes of EEPROM used by saveCalibration().
+  static const uint8_t calibrationRecordSize = 8 + 4 * 2 * _sensorCount;
+
+  /// \brief Saves the calibration data to EEPROM.
+  ///
+  /// \param address The EEPROM address at which to store the data. The
+  /// data takes up #calibrationRecordSize bytes starting at this address.
+  ///
+  /// This method stores both #calibrationOn and #calibrationOff in EEPROM,
+  /// along with a header, the current timeout (see setTimeout()), and a CRC,
+  /// so that loadCalibration() can restore them after the robot is reset and
+  /// the calibration sweep can be skipped. Only bytes that differ from what
+  /// is already in EEPROM are written, so saving the same calibration
+  /// repeatedly does not wear out the EEPROM.
+  void saveCalibration(uint16_t address = 0);
+
+  /// \brief Loads calibration data saved by saveCalibration().
+  ///
+  /// \param address The EEPROM address that was passed to
+  /// saveCalibration().
+  ///
+  /// \return True if valid calibration data was loaded; false otherwise.
+  ///
+  /// The data is only loaded if it has the right header and CRC. Readings
+  /// taken with a different timeout are not comparable, so loading the data
+  /// also restores the timeout that was set when it was saved (see
+  /// setTimeout()), including one chosen by autoTuneTimeout(). If it is not
+  /// valid, the current calibration and timeout are left unchanged and you
+  /// should calibrate the sensors again.
+  ///
+  /// Example usage:
+  /// ~~~{.cpp}
+  /// if (!lineSensors.loadCalibration())
+  /// {
+  ///   // ... run the usual calibration sweep ...
+  ///   lineSensors.saveCalibration();
+  /// }
+  /// ~~~
+  bool loadCalibration(uint16_t address = 0);
+
   /// \brief Reads the raw sensor values into an array.
   ///
   /// \param[out] sensorValues A pointer to an array in which to store the
@@ -129,13 +286,76 @@ public:
   ///
   /// RC sensors will return a raw value in microseconds between 0 and the
   /// timeout setting configured with setTimeout() (the default timeout is
-  /// 2500 &micro;s).
+  /// 2500 &micro;s). They are timed with `micros()`, or to the nearest
+  /// 0.5 &micro;s with Timer 3 if Timer3Clock is running.
   ///
   /// \if usage
   ///   See \ref md_usage for more information and example code.
   /// \endif
   void read(uint16_t * sensorValues, LineSensorsReadMode mode = LineSensorsReadMode::On);
 
+  /// \brief Starts reading the raw sensor values in the background.
+  ///
+  /// \param mode The emitter behavior during the read, as a member of the
+  /// ::LineSensorsReadMode enum. The default is LineSensorsReadMode::On.
+  /// LineSensorsReadMode::Differential is not supported.
+  ///
+  /// This method charges the sensors and then returns right away, while the
+  /// discharge of each sensor is timed by a short interrupt that samples
+  /// the sensor pins every few microseconds (see setAsyncSamplePeriod()).
+  /// Your code can do other work until isReadComplete() returns true and
+  /// then call getReadings() to get the same kind of values that read()
+  /// returns. If the emitters were turned on for the read, they are turned
+  /// off automatically when it finishes.
+  ///
+  /// The background read uses Timer 3 and its `TIMER3_COMPA` interrupt (see
+  /// Timer3Clock). Only one background read can be in progress at a time;
+  /// if one is already running, this method waits for it to finish before
+  /// starting the new one. You should not call read() or any of the other
+  /// reading functions while a background read is in progress.
+  ///
+  /// Example usage:
+  /// ~~~{.cpp}
+  /// uint16_t sensorValues[5];
+  /// lineSensors.startRead();
+  /// // ... do other work here ...
+  /// lineSensors.getReadings(sensorValues);
+  /// ~~~
+  void startRead(LineSensorsReadMode mode = LineSensorsReadMode::On);
+
+  /// \brief Indicates whether the read started by startRead() has finished.
+  ///
+  /// \return True if no background read is in progress; false otherwise.
+  bool isReadComplete();
+
+  /// \brief Gets the raw sensor values from the read started by startRead().
+  ///
+  /// \param[out] sensorValues A pointer to an array in which to store the
+  /// raw sensor readings. There **MUST** be space in the array for five
+  /// readings.
+  ///
+  /// If the read has not finished yet, this method waits for it to finish.
+  void getReadings(uint16_t * sensorValues);
+
+  /// \brief Sets the sampling period used by startRead().
+  ///
+  /// \param period The time between samples of the sensor pins, in
+  /// microseconds.
+  ///
+  /// The readings from a background read have a resolution of one sampling
+  /// period. Shorter periods give finer readings, but each sample is an
+  /// interrupt that takes a few microseconds, so they also leave less time
+  /// for the rest of your program while the read is in progress. The default
+  /// period is 32 &micro;s, which leaves most of the CPU time free.
+  void setAsyncSamplePeriod(uint8_t period);
+
+  /// \brief Returns the sampling period used by startRead().
+  ///
+  /// \return The sampling period in microseconds.
+  ///
+  /// See also setAsyncSamplePeriod().
+  uint8_t getAsyncSamplePeriod() { return _asyncSamplePeriod; }
+
   /// \brief Reads the sensors and provides calibrated values between 0 and
   /// 1000.
   ///
@@ -158,6 +378,47 @@ public:
   /// \endif
   void readCalibrated(uint16_t * sensorValues, LineSensorsReadMode mode = LineSensorsReadMode::On);
 
+  /// \brief Converts raw readings to calibrated values between 0 and 1000.
+  ///
+  /// \param[in,out] sensorValues A pointer to an array of five raw readings,
+  /// which are replaced with calibrated values.
+  ///
+  /// \param mode The emitter behavior that the readings were taken with, as
+  /// a member of the ::LineSensorsReadMode enum. The default is
+  /// LineSensorsReadMode::On. LineSensorsReadMode::Manual is not supported.
+  ///
+  /// This does the same calculation as readCalibrated() without reading the
+  /// sensors, so it can be used on readings taken earlier, such as the
+  /// frames recorded by a LineSensorsFrameLog. Unlike readCalibrated(), it
+  /// does not check whether the calibration has been initialized.
+  void applyCalibration(uint16_t * sensorValues, LineSensorsReadMode mode = LineSensorsReadMode::On);
+
+  /// \brief Computes the line position from calibrated values.
+  ///
+  /// \param sensorValues A pointer to an array of five calibrated values.
+  ///
+  /// \param invertReadings False for a black line (like readLineBlack()),
+  /// true for a white line (like readLineWhite()).
+  ///
+  /// \return An estimate of the line position from 0 to 4000.
+  ///
+  /// This does the same calculation as readLineBlack() and readLineWhite()
+  /// without reading the sensors, including remembering where the line was
+  /// last seen. Together with applyCalibration(), it lets you replay
+  /// recorded frames through the same processing that the robot used.
+  uint16_t linePosition(const uint16_t * sensorValues, bool invertReadings = false);
+
+  /// \brief Starts or stops recording every raw reading in a frame log.
+  ///
+  /// \param log A pointer to the log to record into, or `nullptr` to stop
+  /// recording (the default state).
+  ///
+  /// While a log is set, every call to read(), including the ones made by
+  /// readCalibrated() and the line functions, pushes the raw readings into
+  /// the log together with the mode, a timestamp, and the read duration.
+  /// This costs a few dozen cycles per read. See LineSensorsFrameLog.
+  void setFrameLog(LineSensorsFrameLog * log) { _frameLog = log; }
+
   /// \brief Reads the sensors, provides calibrated values, and returns an
   /// estimated black line position.
   ///
@@ -231,19 +492,107 @@ public:
     return readLinePrivate(sensorValues, mode, true);
   }
 
+  /// \brief Reads the sensors, filters the calibrated values, and returns
+  /// a filtered estimate of the black line position.
+  ///
+  /// \param[out] sensorValues A pointer to an array in which to store the
+  /// filtered, calibrated sensor readings.  There **MUST** be space in the
+  /// array for five values.
+  ///
+  /// \param filter The filter to apply, such as one of the stages in
+  /// Pololu3piPlus32U4LineFilters.h or a LineFilterChain of several of them.
+  ///
+  /// \param mode The emitter behavior during the read, as a member of the
+  /// ::LineSensorsReadMode enum. The default is LineSensorsReadMode::On. Manual
+  /// emitter control with LineSensorsReadMode::Manual is not supported.
+  ///
+  /// \return The filtered estimate of the line position.
+  ///
+  /// This works like readLineBlack(), except that the calibrated readings
+  /// are passed through the filter before the position is computed, and the
+  /// position is passed through the filter before it is returned. The filter
+  /// keeps its own state, so you should use a separate filter object for each
+  /// kind of reading you take.
+  ///
+  /// Example usage:
+  /// ~~~{.cpp}
+  /// #include <Pololu3piPlus32U4LineFilters.h>
+  ///
+  /// LineFilterChain<LineMedian3Filter, LinePositionFilter<2>> lineFilter;
+  ///
+  /// // in loop():
+  /// uint16_t position = lineSensors.readLineBlack(lineSensorValues, lineFilter);
+  /// ~~~
+  template <class Filter>
+  uint16_t readLineBlack(uint16_t * sensorValues, Filter & filter,
+    LineSensorsReadMode mode = LineSensorsReadMode::On)
+  {
+    return readLineFiltered(sensorValues, filter, mode, false);
+  }
+
+  /// \brief Reads the sensors, filters the calibrated values, and returns
+  /// a filtered estimate of the white line position.
+  ///
+  /// This is like the filtered version of readLineBlack(), but for a white
+  /// (or light-colored) line on a black (or dark-colored) background.
+  template <class Filter>
+  uint16_t readLineWhite(uint16_t * sensorValues, Filter & filter,
+    LineSensorsReadMode mode = LineSensorsReadMode::On)
+  {
+    return readLineFiltered(sensorValues, filter, mode, true);
+  }
+
+  /// \brief Reads the sensors, provides calibrated values, and returns a
+  /// detailed estimate of a black line.
+  ///
+  /// \param[out] sensorValues A pointer to an array in which to store the
+  /// calibrated sensor readings.  There **MUST** be space in the array for
+  /// five values.
+  ///
+  /// \param mode The emitter behavior during the read, as a member of the
+  /// ::LineSensorsReadMode enum. The default is LineSensorsReadMode::On. Manual
+  /// emitter control with LineSensorsReadMode::Manual is not supported.
+  ///
+  /// \return A LineEstimate describing the line.
+  ///
+  /// All of the fields are computed in one pass over the readings:
+  ///
+  /// * The position is found by fitting a parabola through the highest
+  ///   reading and the readings on either side of it, which follows the
+  ///   line more smoothly between sensors than the weighted average used by
+  ///   readLineBlack(). If the highest reading is on an outer sensor, the
+  ///   weighted average is used instead. When the line is lost, the position
+  ///   is 0 or 4000 depending on where the line was last seen, just like
+  ///   readLineBlack().
+  /// * The width is the sum of the readings divided by the highest reading,
+  ///   so a line seen by only one sensor is 1000 wide.
+  /// * The confidence is the difference between the highest and lowest
+  ///   readings.
+  /// * The flags report branches and crossings (see ::LineFeature), based on
+  ///   which sensors have readings above 500.
+  ///
+  /// This function shares its memory of the last line position with
+  /// readLineBlack() and readLineWhite().
+  LineEstimate readLineEstimateBlack(uint16_t * sensorValues, LineSensorsReadMode mode = LineSensorsReadMode::On)
+  {
+    return readLineEstimatePrivate(sensorValues, mode, false);
+  }
+
+  /// \brief Reads the sensors, provides calibrated values, and returns a
+  /// detailed estimate of a white line.
+  ///
+  /// This is like readLineEstimateBlack(), but for a white (or
+  /// light-colored) line on a black (or dark-colored) background.
+  LineEstimate readLineEstimateWhite(uint16_t * sensorValues, LineSensorsReadMode mode = LineSensorsReadMode::On)
+  {
+    return readLineEstimatePrivate(sensorValues, mode, true);
+  }
+
 
   /// \brief Stores sensor calibration data.
   ///
   /// See calibrate() and readCalibrated() for details.
-  struct CalibrationData
-  {
-    /// Whether array pointers have been allocated and initialized.
-    bool initialized = false;
-    /// Lowest readings seen during calibration.
-    uint16_t * minimum = nullptr;
-    /// Highest readings seen during calibration.
-    uint16_t * maximum = nullptr;
-  };
+  typedef LineSensorsCalibrationData<_sensorCount> CalibrationData;
 
   /// \name Calibration data
   ///
@@ -262,6 +611,65 @@ public:
 
   /// \}
 
+  /// \brief Stores how far calibration tracking has moved the calibration.
+  ///
+  /// See setCalibrationTracking().
+  struct CalibrationDrift
+  {
+    /// Net change in each minimum value, in microseconds.
+    int16_t minimum[_sensorCount];
+    /// Net change in each maximum value, in microseconds.
+    int16_t maximum[_sensorCount];
+  };
+
+  /// \brief How far calibration tracking has moved #calibrationOn since it
+  /// was enabled.
+  ///
+  /// See setCalibrationTracking().
+  CalibrationDrift calibrationDrift;
+
+  /// Default rate for calibration tracking; see setCalibrationTracking().
+  static const uint8_t defaultTrackingShift = 6;
+
+  /// \brief Enables or disables calibration tracking.
+  ///
+  /// \param enable True to adapt the calibration to the readings taken
+  /// while the robot runs; false to keep it fixed (the default).
+  ///
+  /// \param shift How slowly the calibration adapts. A calibration value
+  /// moves outward by 1/2<sup>shift</sup> of the distance to each reading
+  /// outside the range, and inward by 1 &micro;s at most once every
+  /// 2<sup>shift</sup> readings, so with the default of 6 and about 1000
+  /// readings per second, a value can move inward by about 16 &micro;s per
+  /// second.
+  ///
+  /// The calibration normally stays as it was when calibrate() was last
+  /// called, but the readings can drift during a long run, for example as
+  /// the battery voltage sags and the emitters get dimmer. With tracking
+  /// enabled, every emitters-on reading taken by readCalibrated() (and so by
+  /// readLineBlack() and the other line functions) is compared to
+  /// #calibrationOn:
+  ///
+  /// * A reading below a sensor's minimum or above its maximum widens the
+  ///   calibrated range 1/2<sup>shift</sup> of the way toward it (rounded
+  ///   up). Readings that stay outside the range are soon covered, but a
+  ///   single glitch, such as a timeout while the robot is lifted, only
+  ///   moves the range a little.
+  /// * A reading inside the range slowly pulls in the minimum or maximum,
+  ///   whichever is on the same side of the middle of the range, as
+  ///   described above. This is slow on purpose: a sensor that spends a
+  ///   while partly over the edge of the line should not make that reading
+  ///   look like the full line.
+  ///
+  /// #calibrationDrift records the net change of each value since tracking
+  /// was enabled, so you can check how much the sensors have drifted.
+  ///
+  /// While tracking is enabled, readCalibrated() only updates a sensor's
+  /// scale factor (which takes one division) once its calibrated range has
+  /// changed by more than 1/64, and until then uses the range the factor was
+  /// computed for, so tracking costs little time.
+  void setCalibrationTracking(bool enable, uint8_t shift = defaultTrackingShift);
+
   /// \brief Turns the IR LEDs on.
   void emittersOn()
   {
@@ -276,17 +684,162 @@ public:
 
 private:
 
-  // Handles the actual calibration, including (re)allocating and
-  // initializing the storage for the calibration values if necessary.
+  // Handles the actual calibration, including initializing the calibration
+  // values if necessary.
   void calibrateOnOrOff(CalibrationData & calibration, LineSensorsReadMode mode);
 
   void readPrivate(uint16_t * sensorValues);
 
+  void readDifferential(uint16_t * sensorValues);
+
+  void trackCalibration(const uint16_t * sensorValues);
+
+  // Fixed-point reciprocals of (maximum - minimum) for each sensor, which let
+  // readCalibrated() scale readings with a multiply instead of a 32-bit
+  // division.  Each entry remembers the denominator it was computed from.
+  struct CalibrationReciprocals
+  {
+    uint16_t denominator[_sensorCount];
+    uint32_t factor[_sensorCount];
+  };
+
+  void updateReciprocals(const CalibrationData & calibration,
+                         CalibrationReciprocals & reciprocals);
+
+  static void updateReciprocal(CalibrationReciprocals & reciprocals,
+                               uint8_t i, uint16_t denominator);
+
   uint16_t readLinePrivate(uint16_t * sensorValues, LineSensorsReadMode mode, bool invertReadings);
 
+  template <class Filter>
+  uint16_t readLineFiltered(uint16_t * sensorValues, Filter & filter,
+    LineSensorsReadMode mode, bool invertReadings)
+  {
+    // manual emitter control is not supported
+    if (mode == LineSensorsReadMode::Manual) { return 0; }
+
+    readCalibrated(sensorValues, mode);
+    filter.filterReadings(sensorValues);
+    return filter.filterPosition(linePosition(sensorValues, invertReadings));
+  }
+
+  LineEstimate readLineEstimatePrivate(uint16_t * sensorValues, LineSensorsReadMode mode, bool invertReadings);
+
   uint16_t _timeout = defaultTimeout;
   uint16_t _maxValue = defaultTimeout; // the maximum value returned by readPrivate()
   uint16_t _lastPosition = 0;
+  uint16_t _lastReadDuration = 0;
+  CalibrationReciprocals _reciprocalsOn = {};
+  CalibrationReciprocals _reciprocalsOff = {};
+  uint8_t _asyncSamplePeriod = defaultAsyncSamplePeriod;
+  LineSensorsFrameLog * _frameLog = nullptr;
+  bool _trackingEnabled = false;
+  uint8_t _trackingShift = defaultTrackingShift;
+  uint16_t _trackingCount = 0;  // readings since the last inward step
+};
+
+/// \brief A set of raw line sensor readings recorded by a
+/// LineSensorsFrameLog.
+struct LineSensorsFrame
+{
+  /// The value of `micros()` when the read started.
+  uint32_t timestamp;
+
+  /// How long the read took, in microseconds (see
+  /// LineSensors::getLastReadDuration()).
+  uint16_t duration;
+
+  /// The emitter mode used for the read.
+  LineSensorsReadMode mode;
+
+  /// The raw readings, as returned by LineSensors::read().
+  uint16_t values[LineSensors::_sensorCount];
+};
+
+/// \brief A ring buffer of raw line sensor frames.
+///
+/// Pass a log to LineSensors::setFrameLog() to record every raw reading
+/// along with its mode, timestamp, and duration. When the buffer is full,
+/// the oldest frame is overwritten, so it always holds the most recent
+/// frames. Your program can drain the log with pop(), for example by
+/// printing the frames over USB serial, and the frames can later be
+/// replayed through LineSensors::applyCalibration() and
+/// LineSensors::linePosition() to reproduce what the robot saw.
+///
+/// This class does not hold any storage itself; use LineSensorsFrameBuffer
+/// to create a log with a fixed number of frames:
+///
+/// ~~~{.cpp}
+/// LineSensorsFrameBuffer<32> frameLog;
+///
+/// void setup()
+/// {
+///   lineSensors.setFrameLog(&frameLog);
+/// }
+///
+/// void printFrames()
+/// {
+///   LineSensorsFrame frame;
+///   while (frameLog.pop(frame))
+///   {
+///     Serial.print(frame.timestamp);
+///     // ...
+///   }
+/// }
+/// ~~~
+///
+/// The log is not meant to be used from interrupts.
+class LineSensorsFrameLog
+{
+public:
+  /// \brief Removes the oldest frame from the log.
+  ///
+  /// \param[out] frame The frame that was removed.
+  ///
+  /// \return True if a frame was removed; false if the log was empty.
+  bool pop(LineSensorsFrame & frame);
+
+  /// \brief Returns the number of frames in the log.
+  uint8_t available() { return count; }
+
+  /// \brief Returns the number of frames that were overwritten because the
+  /// log was full.
+  uint16_t getOverwrittenCount() { return overwritten; }
+
+  /// \brief Removes all frames from the log and resets the overwritten count.
+  void clear();
+
+protected:
+  LineSensorsFrameLog(LineSensorsFrame * frames, uint8_t capacity)
+    : frames(frames), capacity(capacity) {}
+
+private:
+  friend class LineSensors;
+
+  void push(const uint16_t * sensorValues, LineSensorsReadMode mode,
+    uint32_t timestamp, uint16_t duration);
+
+  LineSensorsFrame * frames;
+  uint8_t capacity;
+  uint8_t head = 0;   // where the next frame goes
+  uint8_t count = 0;
+  uint16_t overwritten = 0;
+};
+
+/// \brief A LineSensorsFrameLog with storage for a fixed number of frames.
+///
+/// \tparam frameCount The number of frames to store, from 1 to 255. Each frame
+/// takes 17 bytes of RAM.
+template <uint8_t frameCount>
+class LineSensorsFrameBuffer : public LineSensorsFrameLog
+{
+  static_assert(frameCount > 0, "LineSensorsFrameBuffer needs at least one frame");
+
+public:
+  LineSensorsFrameBuffer() : LineSensorsFrameLog(storage, frameCount) {}
+
+private:
+  LineSensorsFrame storage[frameCount];
 };
 
 }
@@ -0,0 +1,115 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+// Background line sensor reads.  These are kept apart from the rest of
+// LineSensors so that the Timer 3 compare A interrupt they need is only
+// linked into sketches that call startRead().
+
+#include <Pololu3piPlus32U4LineSensors.h>
+#include <Pololu3piPlus32U4SensorArrays.h>
+#include <Pololu3piPlus32U4Timer3Clock.h>
+
+namespace Pololu3piPlus32U4
+{
+
+// State of the background read started by startRead().  There is only one
+// Timer 3 compare channel for it, so only one read can be in progress at a
+// time and the state does not need to live in the LineSensors object.
+static volatile bool asyncBusy;
+static volatile bool asyncEmittersOn;
+static LineArray::PortBits asyncPending;  // only used by the ISR once started
+static uint16_t asyncStartTicks;
+static uint16_t asyncTimeout;
+static uint16_t asyncPeriodTicks;
+static volatile uint16_t asyncDuration;
+static volatile uint16_t asyncValues[LineSensors::_sensorCount];
+
+ISR(TIMER3_COMPA_vect)
+{
+  uint16_t time = (uint16_t)(TCNT3 - asyncStartTicks) / Timer3Clock::ticksPerMicrosecond;
+
+  LineArray::PortBits fallen = LineArray::fallen(asyncPending, LineArray::sample());
+  if (LineArray::any(fallen))
+  {
+    LineArray::record(asyncValues, fallen, time);
+    LineArray::clear(asyncPending, fallen);
+  }
+
+  if (!LineArray::any(asyncPending) || time >= asyncTimeout)
+  {
+    asyncDuration = time;
+    // Sensors that have not fallen yet keep the timeout value that
+    // startRead() stored for them.
+    TIMSK3 &= ~(1 << OCIE3A);
+    if (asyncEmittersOn) { FastGPIO::Pin<LineSensors::emitterPin>::setInput(); }
+    asyncBusy = false;
+    return;
+  }
+
+  // Schedule the next sample relative to now rather than to the last compare
+  // value so that a late interrupt can never push it a whole timer period out.
+  OCR3A = TCNT3 + asyncPeriodTicks;
+}
+
+void LineSensors::startRead(LineSensorsReadMode mode)
+{
+  // the differential mode cannot run in the background
+  if (mode == LineSensorsReadMode::Differential) { return; }
+
+  Timer3Clock::init();
+
+  // wait for any read that is already in progress
+  while (asyncBusy);
+
+  switch (mode)
+  {
+    case LineSensorsReadMode::Off:
+      emittersOff();
+      break;
+
+    case LineSensorsReadMode::On:
+      emittersOn();
+      break;
+
+    default: // manual - leave the emitters alone
+      break;
+  }
+  asyncEmittersOn = (mode == LineSensorsReadMode::On);
+
+  LineArray::charge();
+  _delay_us(10);
+
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    asyncValues[i] = _timeout;
+  }
+  asyncTimeout = _timeout;
+  asyncPeriodTicks = (uint16_t)_asyncSamplePeriod * Timer3Clock::ticksPerMicrosecond;
+  asyncPending = LineArray::allPins();
+  asyncBusy = true;
+
+  noInterrupts();
+  asyncStartTicks = TCNT3;
+  LineArray::release();
+  OCR3A = asyncStartTicks + asyncPeriodTicks;
+  TIFR3 = (1 << OCF3A);  // Clear its interrupt flag by writing a 1.
+  TIMSK3 |= (1 << OCIE3A);
+  interrupts();
+}
+
+bool LineSensors::isReadComplete()
+{
+  return !asyncBusy;
+}
+
+void LineSensors::getReadings(uint16_t * sensorValues)
+{
+  while (asyncBusy);
+
+  for (uint8_t i = 0; i < _sensorCount; i++)
+  {
+    sensorValues[i] = asyncValues[i];
+  }
+  _lastReadDuration = asyncDuration;
+}
+
+}
@@ -0,0 +1,103 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4LineSensorsMath.h
+///
+/// \brief Integer math used by LineSensors.
+///
+/// These functions do not access any hardware, so they can also be compiled
+/// and checked on a PC by the tests in the `extras/test` folder.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \brief Fixed-point arithmetic behind LineSensors::readCalibrated().
+class LineSensorsMath
+{
+public:
+
+  /// \brief Returns the scale factor that scaleReading() uses for a
+  /// calibrated range of \p denominator.
+  ///
+  /// The factor is floor(1000 &times; 65536 / \p denominator), or 0 if
+  /// \p denominator is 0.
+  static uint32_t reciprocal(uint16_t denominator)
+  {
+    return (denominator == 0) ? 0 : 65536000 / denominator;
+  }
+
+  /// \brief Scales a raw reading to the range 0 to 1000.
+  ///
+  /// Returns (\p reading - \p calmin) &times; 1000 / \p denominator, rounded
+  /// down and clamped to 0-1000, using the \p factor from reciprocal()
+  /// instead of a division.  Since \p reading - \p calmin is less than
+  /// 65536, the product estimate is either exact or one too low, and a single
+  /// multiply-and-compare corrects it.  A \p denominator of 0 gives 0.
+  static uint16_t scaleReading(uint16_t reading, uint16_t calmin,
+                               uint16_t denominator, uint32_t factor)
+  {
+    if (denominator == 0 || reading <= calmin) { return 0; }
+
+    uint16_t x = reading - calmin;
+    if (x >= denominator) { return 1000; }
+
+    uint16_t value = ((uint32_t)x * factor) >> 16;
+    if ((uint32_t)(value + 1) * denominator <= (uint32_t)x * 1000) { value++; }
+    return value;
+  }
+
+  /// \brief Removes the ambient light from an emitters-on reading.
+  ///
+  /// \param on The emitters-on reading.
+  /// \param off The emitters-off reading, which must be greater than
+  /// \p on and less than 32768.
+  /// \param limit The largest value to return.
+  ///
+  /// Returns \p on &times; \p off / (\p off - \p on), rounded down and
+  /// limited to \p limit: the discharge time the sensor would have had with
+  /// only the emitter light.
+  ///
+  /// A 32-bit division takes about 600 cycles on the AVR, so this computes
+  /// a fixed-point reciprocal of \p off - \p on instead. It starts with a
+  /// linear estimate that is within 1/17 of the reciprocal and refines it
+  /// with two Newton-Raphson steps. The quotient then comes from a few 16-bit
+  /// multiplies. A final multiply-and-compare corrects it, so the result is
+  /// exact.
+  static uint16_t removeAmbient(uint16_t on, uint16_t off, uint16_t limit)
+  {
+    uint16_t d = off - on;
+    uint32_t n = (uint32_t)on * off;
+    if (n >= (uint32_t)limit * d) { return limit; }
+
+    // Shift d up to dn = d * 2^s, between 2^15 and 2^16.
+    uint16_t dn = d;
+    uint8_t s = 0;
+    if (dn < 0x100) { dn <<= 8; s = 8; }
+    while (dn < 0x8000) { dn <<= 1; s++; }
+
+    // x approximates 2^31 / dn; each step squares its relative error.
+    uint16_t x = 92521 - (((uint32_t)dn * 61681) >> 16);
+    for (uint8_t i = 0; i < 2; i++)
+    {
+      int32_t e = (int32_t)(0x80000000 - (uint32_t)dn * x);
+      x += ((int32_t)x * (e >> 15)) >> 16;
+    }
+
+    // q = on * off * x / 2^(31 - s), with the 48-bit product split into two
+    // 16x16-bit multiplies.
+    uint32_t t = (uint32_t)off * x;
+    uint32_t p = (uint32_t)on * (uint16_t)(t >> 16) +
+      (((uint32_t)on * (uint16_t)t) >> 16);
+    uint16_t q = p >> (15 - s);
+
+    int32_t r = n - (uint32_t)q * d;
+    while (r < 0) { q--; r += d; }
+    while (r >= d) { q++; r -= d; }
+    return q;
+  }
+};
+
+}
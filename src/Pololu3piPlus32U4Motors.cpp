@@ -3,6 +3,7 @@
 #include <Pololu3piPlus32U4Motors.h>
 #include <FastGPIO.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 namespace Pololu3piPlus32U4
 {
@@ -14,6 +15,30 @@ namespace Pololu3piPlus32U4
 
 bool Motors::flipLeft = false;
 bool Motors::flipRight = false;
+volatile bool Motors::emergencyStopped = false;
+
+// TCCR1A value with both PWM outputs connected (non-inverting) and without.
+static const uint8_t pwmOutputsOn = 0b10100000;
+static const uint8_t pwmOutputsOff = 0b00000000;
+
+// PWM configuration: the Timer 1 TOP value (ICR1), its clock select bits,
+// and the speed that maps to a duty cycle of 100%.  speedScale converts a
+// speed to a compare value and has 16 fraction bits.
+static uint16_t pwmTop = 400;
+static uint8_t pwmClockSelect = 0b001;
+static uint16_t pwmPrescaler = 1;
+static uint16_t maxSpeed = 400;
+static uint32_t speedScale = 1UL << 16;
+
+// The magnitudes of the last speeds set, so they can be rescaled when the
+// configuration changes.
+static uint16_t magnitudeLeft;
+static uint16_t magnitudeRight;
+
+static inline uint16_t speedToCompare(uint16_t magnitude)
+{
+    return ((uint32_t)magnitude * speedScale) >> 16;
+}
 
 // initialize timer1 to generate the proper PWM outputs to the motor drivers
 void Motors::init2()
@@ -24,16 +49,16 @@ void Motors::init2()
     FastGPIO::Pin<DIR_R>::setOutputLow();
 
     // Timer 1 configuration
-    // prescaler: clockI/O / 1
+    // prescaler: clockI/O / 1 (by default; see setPwmConfiguration())
     // outputs enabled
-    // phase-correct PWM
-    // top of 400
+    // phase and frequency correct PWM
+    // top of 400 (by default)
     //
     // PWM frequency calculation
     // 16MHz / 1 (prescaler) / 2 (phase-correct) / 400 (top) = 20kHz
-    TCCR1A = 0b10100000;
-    TCCR1B = 0b00010001;
-    ICR1 = 400;
+    TCCR1A = emergencyStopped ? pwmOutputsOff : pwmOutputsOn;
+    TCCR1B = 0b00010000 | pwmClockSelect;
+    ICR1 = pwmTop;
     OCR1A = 0;
     OCR1B = 0;
 }
@@ -48,23 +73,43 @@ void Motors::flipRightMotor(bool flip)
     flipRight = flip;
 }
 
-void Motors::setLeftSpeed(int16_t speed)
+void Motors::begin()
 {
     init();
+}
 
-    bool reverse = 0;
+// Limits a speed to maxSpeed and splits it into a magnitude and a direction.
+static inline uint16_t speedMagnitude(int16_t speed, bool & reverse)
+{
+    reverse = 0;
 
     if (speed < 0)
     {
         speed = -speed; // Make speed a positive quantity.
         reverse = 1;    // Preserve the direction.
     }
-    if (speed > 400)
+    if (speed > (int16_t)maxSpeed)
     {
-        speed = 400;
+        speed = maxSpeed;
     }
+    return speed;
+}
+
+void Motors::setLeftSpeed(int16_t speed)
+{
+    init();
+
+    bool reverse;
+    uint16_t magnitude = speedMagnitude(speed, reverse);
 
-    OCR1B = speed;
+    // Timer 1's 16-bit registers share a temporary byte, so the write must
+    // not be interrupted by emergencyStop().
+    uint8_t sreg = SREG;
+    cli();
+    if (emergencyStopped) { magnitude = 0; }
+    magnitudeLeft = magnitude;
+    OCR1B = speedToCompare(magnitude);
+    SREG = sreg;
 
     FastGPIO::Pin<DIR_L>::setOutput(reverse ^ flipLeft);
 }
@@ -73,27 +118,170 @@ void Motors::setRightSpeed(int16_t speed)
 {
     init();
 
-    bool reverse = 0;
+    bool reverse;
+    uint16_t magnitude = speedMagnitude(speed, reverse);
 
-    if (speed < 0)
+    uint8_t sreg = SREG;
+    cli();
+    if (emergencyStopped) { magnitude = 0; }
+    magnitudeRight = magnitude;
+    OCR1A = speedToCompare(magnitude);
+    SREG = sreg;
+
+    FastGPIO::Pin<DIR_R>::setOutput(reverse ^ flipRight);
+}
+
+void Motors::setSpeeds(int16_t leftSpeed, int16_t rightSpeed)
+{
+    init();
+
+    bool reverseLeft, reverseRight;
+    uint16_t left = speedMagnitude(leftSpeed, reverseLeft);
+    uint16_t right = speedMagnitude(rightSpeed, reverseRight);
+    uint16_t compareLeft = speedToCompare(left);
+    uint16_t compareRight = speedToCompare(right);
+    reverseLeft ^= flipLeft;
+    reverseRight ^= flipRight;
+
+    // The compare registers are double-buffered and both get loaded from
+    // their buffers when the counter reaches BOTTOM. If that happened
+    // between the two writes below, one motor would run a period at its new
+    // duty cycle and the other at its old one, so wait until the counter
+    // is far enough from BOTTOM that the writes will finish first. The
+    // critical section takes well under 64 CPU cycles, so a margin of 64
+    // ticks is enough with any prescaler. Interrupts stay enabled while
+    // waiting, and the counter is only below the margin once per period,
+    // for twice the margin.
+    uint16_t margin = pwmTop < 128 ? pwmTop / 2 : 64;
+
+    uint8_t sreg = SREG;
+    while (true)
     {
-        speed = -speed;  // Make speed a positive quantity.
-        reverse = 1;     // Preserve the direction.
+        cli();
+        if (TCNT1 >= margin) { break; }
+        SREG = sreg;
     }
-    if (speed > 400)
+    if (emergencyStopped)
     {
-        speed = 400;
+        left = right = 0;
+        compareLeft = compareRight = 0;
     }
+    magnitudeLeft = left;
+    magnitudeRight = right;
+    OCR1B = compareLeft;
+    OCR1A = compareRight;
+    FastGPIO::Pin<DIR_L>::setOutput(reverseLeft);
+    FastGPIO::Pin<DIR_R>::setOutput(reverseRight);
+    SREG = sreg;
+}
 
-    OCR1A = speed;
+bool Motors::setPwmConfiguration(uint16_t top, uint16_t prescaler, uint16_t newMaxSpeed)
+{
+    uint8_t clockSelect;
+    switch (prescaler)
+    {
+    case 1:    clockSelect = 0b001; break;
+    case 8:    clockSelect = 0b010; break;
+    case 64:   clockSelect = 0b011; break;
+    case 256:  clockSelect = 0b100; break;
+    case 1024: clockSelect = 0b101; break;
+    default:   return false;
+    }
+    if (top < 16 || newMaxSpeed == 0 || newMaxSpeed > 32767) { return false; }
 
-    FastGPIO::Pin<DIR_R>::setOutput(reverse ^ flipRight);
+    init();
+
+    uint32_t newScale = (((uint32_t)top << 16) + newMaxSpeed - 1) / newMaxSpeed;
+
+    // The compare registers are double-buffered and load at BOTTOM, but ICR1
+    // (TOP) is not buffered, so a new TOP written while the counter is above
+    // it would make the counter run all the way to 0xFFFF.  To avoid that,
+    // write the rescaled compare values just before a BOTTOM, so they load
+    // there, and then write the new TOP and prescaler right after it, while
+    // the counter is near 0.  Interrupts stay enabled while we wait for the
+    // counter to come down to a window about 256 CPU cycles above BOTTOM,
+    // and are only disabled from there until BOTTOM.  The guard leaves at
+    // least 64 CPU cycles for the writes before BOTTOM.  If an interrupt
+    // delays us past the guard, or a speed changes while we are rescaling
+    // it, we try again.
+    uint16_t guard = 64 / pwmPrescaler + 2;
+    if (guard > pwmTop / 2) { guard = pwmTop / 2; }
+    uint16_t window = guard + 256 / pwmPrescaler;
+
+    while (true)
+    {
+        // Rescale the speeds so the motors keep running at the same fraction
+        // of full speed.  The divisions are slow, so do them up front.
+        uint16_t oldLeft = magnitudeLeft;
+        uint16_t oldRight = magnitudeRight;
+        uint16_t newLeft = ((uint32_t)oldLeft * newMaxSpeed + maxSpeed / 2) / maxSpeed;
+        uint16_t newRight = ((uint32_t)oldRight * newMaxSpeed + maxSpeed / 2) / maxSpeed;
+        uint16_t compareLeft = ((uint32_t)newLeft * newScale) >> 16;
+        uint16_t compareRight = ((uint32_t)newRight * newScale) >> 16;
+
+        // Wait for TOP, so the counter is counting down, and then for it to
+        // get into the window.
+        TIFR1 = (1 << ICF1);  // Clear the TOP flag by writing a 1.
+        while (!(TIFR1 & (1 << ICF1)));
+        TIFR1 = (1 << TOV1);  // Clear the BOTTOM flag by writing a 1.
+        while (TCNT1 > window && !(TIFR1 & (1 << TOV1)));
+
+        cli();
+        if ((TIFR1 & (1 << TOV1)) || TCNT1 < guard ||
+            magnitudeLeft != oldLeft || magnitudeRight != oldRight)
+        {
+            sei();
+            continue;
+        }
+
+        magnitudeLeft = newLeft;
+        magnitudeRight = newRight;
+        speedScale = newScale;
+        maxSpeed = newMaxSpeed;
+        pwmTop = top;
+        pwmClockSelect = clockSelect;
+        pwmPrescaler = prescaler;
+        OCR1B = compareLeft;
+        OCR1A = compareRight;
+
+        while (!(TIFR1 & (1 << TOV1)));
+        ICR1 = top;
+        TCCR1B = 0b00010000 | clockSelect;
+        sei();
+        return true;
+    }
 }
 
-void Motors::setSpeeds(int16_t leftSpeed, int16_t rightSpeed)
+uint16_t Motors::getMaxSpeed()
 {
-    setLeftSpeed(leftSpeed);
-    setRightSpeed(rightSpeed);
+    return maxSpeed;
+}
+
+void Motors::emergencyStop()
+{
+    uint8_t sreg = SREG;
+    cli();
+    emergencyStopped = true;
+    TCCR1A = pwmOutputsOff;  // The pins are already set up to output low.
+    OCR1A = 0;
+    OCR1B = 0;
+    magnitudeLeft = 0;
+    magnitudeRight = 0;
+    SREG = sreg;
+}
+
+void Motors::clearEmergencyStop()
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (emergencyStopped)
+    {
+        emergencyStopped = false;
+        OCR1A = 0;
+        OCR1B = 0;
+        TCCR1A = pwmOutputsOn;
+    }
+    SREG = sreg;
 }
 
 }
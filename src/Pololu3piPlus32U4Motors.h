@@ -17,6 +17,16 @@ class Motors
 {
   public:
 
+    /// \brief Sets up Timer 1 and the motor pins.
+    ///
+    /// The speed-setting functions do this automatically the first time
+    /// they are called, so calling this function is optional. Calling it
+    /// from \c setup() moves that work out of your main loop and makes sure
+    /// the motor pins are driven low from the start. It must not be called
+    /// before the Arduino core has initialized the timers, so do not call it
+    /// from the constructor of a global object.
+    static void begin();
+
     /// \brief Flips the direction of the left motor.
     ///
     /// You can call this function with an argument of \c true if the left motor
@@ -45,6 +55,7 @@ class Motors
     /// \param speed A number from -400 to 400 representing the speed and
     /// direction of the left motor.  Values of -400 or less result in full
     /// speed reverse, and values of 400 or more result in full speed forward.
+    /// (The limit of 400 can be changed with setPwmConfiguration().)
     static void setLeftSpeed(int16_t speed);
 
     /// \brief Sets the speed for the right motor.
@@ -52,18 +63,98 @@ class Motors
     /// \param speed A number from -400 to 400 representing the speed and
     /// direction of the right motor. Values of -400 or less result in full
     /// speed reverse, and values of 400 or more result in full speed forward.
+    /// (The limit of 400 can be changed with setPwmConfiguration().)
     static void setRightSpeed(int16_t speed);
 
     /// \brief Sets the speeds for both motors.
     ///
     /// \param leftSpeed A number from -400 to 400 representing the speed and
-    /// direction of the right motor. Values of -400 or less result in full
+    /// direction of the left motor. Values of -400 or less result in full
     /// speed reverse, and values of 400 or more result in full speed forward.
     /// \param rightSpeed A number from -400 to 400 representing the speed and
     /// direction of the right motor. Values of -400 or less result in full
     /// speed reverse, and values of 400 or more result in full speed forward.
+    ///
+    /// Both duty cycles and both direction pins are updated together with
+    /// interrupts disabled, and the new duty cycles take effect at the start
+    /// of the same PWM period, so the two motors never spend a period with
+    /// one at its old speed and the other at its new one. This makes it a
+    /// better choice than two calls to setLeftSpeed() and setRightSpeed() in
+    /// a control loop. To do that, it might wait for up to 128 Timer 1 ticks
+    /// (8 microseconds with the default configuration) for the timer to get
+    /// away from the start of a period; interrupts stay enabled while it
+    /// waits. The direction pins change right away, so a motor that
+    /// reverses direction runs the rest of the current period at its old
+    /// duty cycle in the new direction.
     static void setSpeeds(int16_t leftSpeed, int16_t rightSpeed);
 
+    /// \brief Changes the frequency and resolution of the motor PWM signals.
+    ///
+    /// \param top The number of steps in the PWM duty cycle (the TOP value of
+    /// Timer 1). Must be at least 16. The default is 400.
+    ///
+    /// \param prescaler The Timer 1 clock divider: 1, 8, 64, 256, or 1024.
+    /// The default is 1.
+    ///
+    /// \param maxSpeed The speed argument that corresponds to full speed in
+    /// setLeftSpeed(), setRightSpeed(), and setSpeeds(). Must be from 1 to
+    /// 32767. The default is 400.
+    ///
+    /// \return True if the configuration was applied, or false if one of
+    /// the arguments was invalid.
+    ///
+    /// The motors are driven with phase and frequency correct PWM, so the PWM
+    /// frequency is 16 MHz / \p prescaler / (2 &times; \p top). The default
+    /// configuration gives 20 kHz, which is above the range of human hearing.
+    /// Some alternatives are:
+    ///
+    /// * `setPwmConfiguration(1600, 1, 1600)`: 5 kHz with four times as many
+    ///   duty cycle steps, and speeds from -1600 to 1600, for smoother control
+    ///   at low speeds (the motors will whine audibly).
+    /// * `setPwmConfiguration(1000, 8, 400)`: 1 kHz with the usual speed range,
+    ///   which can give the Hyper edition's motors more torque at low duty
+    ///   cycles.
+    ///
+    /// Speeds are converted to duty cycles with a multiplication by a
+    /// fixed-point scale factor, so \p maxSpeed does not have to equal \p top.
+    /// The change is synchronized with the PWM cycle so that it does not cause
+    /// a glitch in the motor outputs, and the speeds the motors are running at
+    /// are rescaled to \p maxSpeed so that they keep running at the same
+    /// fraction of full speed. This function waits for up to one and a half
+    /// PWM periods (longer if interrupts delay it), but interrupts are only
+    /// disabled for about 256 CPU cycles, or up to three ticks of the old
+    /// Timer 1 clock with a large prescaler: at most about 200 &micro;s.
+    static bool setPwmConfiguration(uint16_t top, uint16_t prescaler = 1,
+        uint16_t maxSpeed = 400);
+
+    /// \brief Returns the speed argument that corresponds to full speed.
+    ///
+    /// This is 400 unless it has been changed with setPwmConfiguration().
+    static uint16_t getMaxSpeed();
+
+    /// \brief Stops both motors immediately and latches a fault.
+    ///
+    /// This function sets both PWM duty cycles to zero and disconnects the
+    /// PWM outputs from Timer 1 so that the motor drivers see a low signal
+    /// right away, instead of at the end of the current PWM period. Until
+    /// clearEmergencyStop() is called, the speed-setting functions leave the
+    /// motors stopped.
+    ///
+    /// This function is safe to call from an interrupt. BumpSensors calls it
+    /// from its background sampling interrupt if
+    /// BumpSensors::stopMotorsOnContact is true.
+    static void emergencyStop();
+
+    /// \brief Returns true if the motors have been stopped by
+    /// emergencyStop() and not restarted since.
+    static bool isEmergencyStopped() { return emergencyStopped; }
+
+    /// \brief Clears the fault latched by emergencyStop().
+    ///
+    /// The motors stay stopped until the next call to one of the
+    /// speed-setting functions.
+    static void clearEmergencyStop();
+
   private:
 
     static inline void init()
@@ -81,6 +172,7 @@ class Motors
 
     static bool flipLeft;
     static bool flipRight;
+    static volatile bool emergencyStopped;
 };
 
 }
@@ -0,0 +1,399 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4RCSensorArray.h
+
+#pragma once
+
+#include <Arduino.h>
+#include <Pololu3piPlus32U4Timer3Clock.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \cond
+namespace RCSensorPins
+{
+  // I/O ports of the ATmega32U4, in the order used by the tables below.
+  enum Port : uint8_t { B, C, D, E, F };
+
+  // The port and bit of each Arduino pin number on the ATmega32U4, using the
+  // same numbering as FastGPIO (so IO_D5 is 30 and IO_E2 is 31).
+  constexpr uint8_t pinPorts[] = {
+    D, D, D, D, D, C, D, E, B, B, B, B, D, C, B, B,
+    B, B, F, F, F, F, F, F, D, D, B, B, B, D, D, E,
+  };
+  constexpr uint8_t pinBits[] = {
+    2, 3, 1, 0, 4, 6, 7, 6, 4, 5, 6, 7, 6, 7, 3, 1,
+    2, 0, 7, 6, 5, 4, 1, 0, 4, 7, 4, 5, 6, 6, 5, 2,
+  };
+
+  constexpr uint8_t portOf(uint8_t pin) { return pinPorts[pin]; }
+  constexpr uint8_t bitOf(uint8_t pin) { return pinBits[pin]; }
+
+  // Returns the bit mask of all the given pins that are on the given port.
+  constexpr uint8_t portMask(uint8_t) { return 0; }
+
+  template <class... Rest>
+  constexpr uint8_t portMask(uint8_t port, uint8_t pin, Rest... rest)
+  {
+    return (portOf(pin) == port ? (1 << bitOf(pin)) : 0) | portMask(port, rest...);
+  }
+}
+
+// Measures the time since a read started, in Timer3Clock ticks.  It uses
+// Timer 3 if Timer3Clock is running, and micros() otherwise so that the
+// blocking reads do not take over the timer.  The Timer 3 count is
+// extended to 32 bits, so it must be read at least once per overflow, but
+// a late iteration can never miss the timeout and wait another overflow.
+class RCSensorClock
+{
+public:
+  // These must be called with interrupts disabled.
+  void start()
+  {
+    useTimer3 = Timer3Clock::isRunning();
+    elapsed = 0;
+    if (useTimer3) { lastTicks = TCNT3; }
+    else { startMicros = micros(); }
+  }
+
+  uint32_t ticks()
+  {
+    if (useTimer3)
+    {
+      uint16_t now = TCNT3;
+      elapsed += (uint16_t)(now - lastTicks);
+      lastTicks = now;
+    }
+    else
+    {
+      elapsed = (micros() - startMicros) * Timer3Clock::ticksPerMicrosecond;
+    }
+    return elapsed;
+  }
+
+private:
+  bool useTimer3;
+  uint16_t lastTicks;
+  uint32_t startMicros;
+  uint32_t elapsed;
+};
+/// \endcond
+
+/// \brief Reads an array of RC reflectance sensors on any set of pins.
+///
+/// \tparam pins The Arduino pin numbers of the sensors, in the order their
+/// readings should be stored.
+///
+/// An RC sensor is read by charging its capacitor through the pin, then
+/// making the pin an input and timing how long the voltage takes to fall:
+/// the more light reaches the phototransistor, the faster it falls. This
+/// class generates the code for doing that with all the given pins at
+/// once.  The pins are grouped by I/O port at compile time, so charging and
+/// releasing the sensors takes one register write per port, and each
+/// polling step reads each port only once and looks for falling pins with
+/// bit masks.  The discharge is timed with Timer3Clock, to the nearest
+/// 0.5 &micro;s, if it is running, or with `micros()`, to the nearest
+/// 4 &micro;s, if it is not (see Timer3Clock::isRunning()).
+///
+/// The 3pi+ 32U4 uses this class for its line sensors (see LineSensors) and
+/// bump sensors (see BumpSensors), and you can also use it to read extra RC
+/// sensors connected to expansion pins:
+///
+/// ~~~{.cpp}
+/// RCSensorArray<IO_D2, IO_D3> extraSensors;
+/// uint16_t values[2];
+/// extraSensors.read(values, 2000);
+/// ~~~
+///
+/// Turning on any emitters that the sensors need is up to the caller.
+template <uint8_t... pins>
+class RCSensorArray
+{
+public:
+  /// The number of sensors in the array.
+  static const uint8_t sensorCount = sizeof...(pins);
+
+  /// \cond
+  // One byte per port, with a bit set for each of our pins on that port.
+  struct PortBits
+  {
+    uint8_t b, c, d, e, f;
+  };
+
+  static const uint8_t maskB = RCSensorPins::portMask(RCSensorPins::B, pins...);
+  static const uint8_t maskC = RCSensorPins::portMask(RCSensorPins::C, pins...);
+  static const uint8_t maskD = RCSensorPins::portMask(RCSensorPins::D, pins...);
+  static const uint8_t maskE = RCSensorPins::portMask(RCSensorPins::E, pins...);
+  static const uint8_t maskF = RCSensorPins::portMask(RCSensorPins::F, pins...);
+
+  static PortBits allPins()
+  {
+    return PortBits { maskB, maskC, maskD, maskE, maskF };
+  }
+
+  // Reads each port that has any of our pins on it.
+  static PortBits sample()
+  {
+    return PortBits {
+      (uint8_t)(maskB ? PINB : 0),
+      (uint8_t)(maskC ? PINC : 0),
+      (uint8_t)(maskD ? PIND : 0),
+      (uint8_t)(maskE ? PINE : 0),
+      (uint8_t)(maskF ? PINF : 0),
+    };
+  }
+
+  // Returns the pins in pending that are low in the sample.
+  static PortBits fallen(const PortBits & pending, const PortBits & sample)
+  {
+    return PortBits {
+      (uint8_t)(pending.b & ~sample.b),
+      (uint8_t)(pending.c & ~sample.c),
+      (uint8_t)(pending.d & ~sample.d),
+      (uint8_t)(pending.e & ~sample.e),
+      (uint8_t)(pending.f & ~sample.f),
+    };
+  }
+
+  static bool any(const PortBits & bits)
+  {
+    return (bits.b | bits.c | bits.d | bits.e | bits.f) != 0;
+  }
+
+  static void clear(PortBits & bits, const PortBits & clearBits)
+  {
+    bits.b &= ~clearBits.b;
+    bits.c &= ~clearBits.c;
+    bits.d &= ~clearBits.d;
+    bits.e &= ~clearBits.e;
+    bits.f &= ~clearBits.f;
+  }
+
+  // Stores the time for each sensor whose pin is set in bits.
+  template <typename T>
+  static void record(T * values, PortBits bits, uint16_t time)
+  {
+    for (uint8_t i = 0; i < sensorCount; i++)
+    {
+      if (portByte(bits, ports[i]) & masks[i]) { values[i] = time; }
+    }
+  }
+  /// \endcond
+
+  /// \brief Drives all of the sensor pins high to charge the sensors.
+  ///
+  /// The sensors should be charged for about 10 &micro;s before they are
+  /// released.
+  static void charge()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    if (maskB) { PORTB |= maskB; DDRB |= maskB; }
+    if (maskC) { PORTC |= maskC; DDRC |= maskC; }
+    if (maskD) { PORTD |= maskD; DDRD |= maskD; }
+    if (maskE) { PORTE |= maskE; DDRE |= maskE; }
+    if (maskF) { PORTF |= maskF; DDRF |= maskF; }
+    SREG = sreg;
+  }
+
+  /// \brief Makes all of the sensor pins inputs so the sensors start to
+  /// discharge.
+  static void release()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    if (maskB) { DDRB &= ~maskB; PORTB &= ~maskB; }
+    if (maskC) { DDRC &= ~maskC; PORTC &= ~maskC; }
+    if (maskD) { DDRD &= ~maskD; PORTD &= ~maskD; }
+    if (maskE) { DDRE &= ~maskE; PORTE &= ~maskE; }
+    if (maskF) { DDRF &= ~maskF; PORTF &= ~maskF; }
+    SREG = sreg;
+  }
+
+  /// \brief Reads the sensors.
+  ///
+  /// \param[out] values A pointer to an array in which to store the
+  /// readings. There **MUST** be space in the array for #sensorCount values.
+  ///
+  /// \param timeout The longest time to wait for a sensor to fall, in
+  /// microseconds (at most 32767). Sensors that have not fallen by then
+  /// read as \p timeout.
+  ///
+  /// \return The duration of the read in microseconds: the time when the
+  /// last sensor fell, or \p timeout.
+  ///
+  /// Each reading is the time, in microseconds, that the sensor took to
+  /// fall after being released. The read ends as soon as every sensor has
+  /// fallen.
+  static uint16_t read(uint16_t * values, uint16_t timeout)
+  {
+    charge();
+    _delay_us(10);
+    return measure(values, timeout);
+  }
+
+  /// \brief Releases the sensors and times their discharge.
+  ///
+  /// This works like read(), except that it does not charge the sensors
+  /// first: the caller must have called charge() at least 10 &micro;s
+  /// earlier.  This lets several arrays share one charging period.
+  static uint16_t measure(uint16_t * values, uint16_t timeout)
+  {
+    for (uint8_t i = 0; i < sensorCount; i++)
+    {
+      values[i] = timeout;
+    }
+
+    uint32_t timeoutTicks = (uint32_t)timeout * Timer3Clock::ticksPerMicrosecond;
+
+    RCSensorClock clock;
+    noInterrupts();
+    clock.start();
+    release();
+    interrupts();
+
+    // Each iteration takes one snapshot of the ports along with the timer
+    // count, so all the sensors are sampled at the same instant and the
+    // common case (nothing fell) costs only a few mask operations.  The
+    // pending bits are set for each sensor that has not fallen yet, so we
+    // can stop as soon as every sensor has been timed.
+    PortBits pending = allPins();
+    uint32_t ticks;
+    while (true)
+    {
+      noInterrupts();
+      ticks = clock.ticks();
+      PortBits now = sample();
+      interrupts();
+
+      if (ticks >= timeoutTicks) { break; }
+
+      PortBits newlyFallen = fallen(pending, now);
+      if (any(newlyFallen))
+      {
+        record(values, newlyFallen, ticks / Timer3Clock::ticksPerMicrosecond);
+        clear(pending, newlyFallen);
+        if (!any(pending)) { break; }
+      }
+      __builtin_avr_delay_cycles(4);  // allow interrupts to run
+    }
+
+    return (ticks >= timeoutTicks) ? timeout : ticks / Timer3Clock::ticksPerMicrosecond;
+  }
+
+  /// \brief Reads the sensors, giving up on each one at its own limit.
+  ///
+  /// \param[out] values A pointer to an array in which to store the
+  /// readings. There **MUST** be space in the array for #sensorCount values.
+  ///
+  /// \param limits A pointer to an array with one time limit per sensor,
+  /// in microseconds (at most 32767 each).
+  ///
+  /// \return The duration of the read in microseconds.
+  ///
+  /// This works like read(), except that each sensor stops being timed once
+  /// its limit has passed, and reads as its limit.  This is useful when all
+  /// you need to know is whether each reading is above or below some
+  /// threshold: the read ends as soon as every sensor has either fallen or
+  /// passed its threshold, instead of waiting for a long timeout.
+  static uint16_t readWithLimits(uint16_t * values, const uint16_t * limits)
+  {
+    charge();
+    _delay_us(10);
+    return measureWithLimits(values, limits);
+  }
+
+  /// \brief Releases the sensors and times their discharge, giving up on
+  /// each one at its own limit.
+  ///
+  /// This works like readWithLimits(), except that the caller must have
+  /// called charge() at least 10 &micro;s earlier.
+  static uint16_t measureWithLimits(uint16_t * values, const uint16_t * limits)
+  {
+    uint16_t limitTicks[sensorCount];
+    uint16_t nextLimitTicks = 0xFFFF;
+    for (uint8_t i = 0; i < sensorCount; i++)
+    {
+      values[i] = limits[i];
+      limitTicks[i] = limits[i] * (uint16_t)Timer3Clock::ticksPerMicrosecond;
+      if (limitTicks[i] < nextLimitTicks) { nextLimitTicks = limitTicks[i]; }
+    }
+
+    RCSensorClock clock;
+    noInterrupts();
+    clock.start();
+    release();
+    interrupts();
+
+    // This is the same loop as in measure(), except that instead of one
+    // timeout there is the earliest limit of the sensors that are still
+    // pending.  When it passes, those sensors are dropped from the pending
+    // bits and the next earliest limit is found.
+    PortBits pending = allPins();
+    uint32_t ticks;
+    while (true)
+    {
+      noInterrupts();
+      ticks = clock.ticks();
+      PortBits now = sample();
+      interrupts();
+
+      PortBits newlyFallen = fallen(pending, now);
+      if (any(newlyFallen))
+      {
+        record(values, newlyFallen, ticks / Timer3Clock::ticksPerMicrosecond);
+        clear(pending, newlyFallen);
+      }
+
+      if (ticks >= nextLimitTicks)
+      {
+        nextLimitTicks = 0xFFFF;
+        for (uint8_t i = 0; i < sensorCount; i++)
+        {
+          uint8_t & portBits = portByte(pending, ports[i]);
+          if (!(portBits & masks[i])) { continue; }
+          if (ticks >= limitTicks[i])
+          {
+            portBits &= ~masks[i];
+          }
+          else if (limitTicks[i] < nextLimitTicks)
+          {
+            nextLimitTicks = limitTicks[i];
+          }
+        }
+      }
+
+      if (!any(pending)) { break; }
+      __builtin_avr_delay_cycles(4);  // allow interrupts to run
+    }
+
+    return ticks / Timer3Clock::ticksPerMicrosecond;
+  }
+
+private:
+  static uint8_t & portByte(PortBits & bits, uint8_t port)
+  {
+    switch (port)
+    {
+    case RCSensorPins::B: return bits.b;
+    case RCSensorPins::C: return bits.c;
+    case RCSensorPins::D: return bits.d;
+    case RCSensorPins::E: return bits.e;
+    default: return bits.f;
+    }
+  }
+
+  static constexpr uint8_t ports[sizeof...(pins)] = { RCSensorPins::portOf(pins)... };
+  static constexpr uint8_t masks[sizeof...(pins)] = { (uint8_t)(1 << RCSensorPins::bitOf(pins))... };
+};
+
+/// \cond
+template <uint8_t... pins>
+constexpr uint8_t RCSensorArray<pins...>::ports[sizeof...(pins)];
+
+template <uint8_t... pins>
+constexpr uint8_t RCSensorArray<pins...>::masks[sizeof...(pins)];
+/// \endcond
+
+}
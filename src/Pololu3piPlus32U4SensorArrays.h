@@ -0,0 +1,35 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4SensorArrays.h
+///
+/// \brief The RCSensorArray types for the 3pi+ 32U4's line and bump
+/// sensors.
+///
+/// These are used by the LineSensors and BumpSensors source files; they are
+/// defined here once so that every read of the same sensors uses the same
+/// pins.
+
+#pragma once
+
+#include <Pololu3piPlus32U4LineSensors.h>
+#include <Pololu3piPlus32U4BumpSensors.h>
+#include <Pololu3piPlus32U4RCSensorArray.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \cond
+// The line sensors as an RC sensor array.  Sensor 0 is on PD6 and sensors 1
+// to 4 are on PF7, PF5, PF4, and PF1, so every sensor can be sampled with one
+// read of PIND and one read of PINF.
+typedef RCSensorArray<LineSensors::line0Pin, LineSensors::line1Pin,
+  LineSensors::line2Pin, LineSensors::line3Pin, LineSensors::line4Pin> LineArray;
+
+static_assert(LineArray::sensorCount == LineSensors::_sensorCount,
+  "LineArray must have one pin per line sensor");
+
+// The bump sensors as an RC sensor array, in the order of the BumpSide enum.
+typedef RCSensorArray<BumpSensors::bumpLeftPin, BumpSensors::bumpRightPin> BumpArray;
+/// \endcond
+
+}
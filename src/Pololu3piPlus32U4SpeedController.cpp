@@ -0,0 +1,153 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+#include <Pololu3piPlus32U4SpeedController.h>
+#include <Pololu3piPlus32U4SpeedControllerMath.h>
+#include <Pololu3piPlus32U4Encoders.h>
+#include <Pololu3piPlus32U4Motors.h>
+#include <Pololu3piPlus32U4Timer3Clock.h>
+#include <avr/interrupt.h>
+
+namespace Pololu3piPlus32U4
+{
+
+typedef SpeedControllerMath::WheelControl WheelControl;
+
+static_assert(SpeedControllerMath::gainShift == SpeedController::gainShift,
+    "SpeedControllerMath must use the SpeedController gain format");
+
+static bool updating;
+static uint16_t periodTicks;
+static int16_t kp = SpeedController::defaultKp;
+static int16_t ki = SpeedController::defaultKi;
+static WheelControl controlLeft;
+static WheelControl controlRight;
+
+// Runs one step of the PI loop and returns the output.  The largest
+// output is read every time so that the loop follows any change made with
+// Motors::setPwmConfiguration().
+static int16_t control(WheelControl & c, int16_t speed)
+{
+    int16_t maxOutput = Motors::getMaxSpeed();
+    return SpeedControllerMath::control(c, speed, kp, ki, maxOutput);
+}
+
+// The update takes a while because of the 32-bit divisions in the speed
+// estimates, so it runs with interrupts enabled to avoid delaying the
+// encoder ISRs.
+ISR(TIMER3_COMPC_vect, ISR_NOBLOCK)
+{
+    cli();
+    // Schedule the next update one period after this one was due, or one
+    // period from now if that time has already passed or is too close to
+    // catch.  The elapsed time is unsigned so that periods longer than half
+    // of the timer's range work.
+    uint16_t now = TCNT3;
+    uint16_t elapsed = now - OCR3C;
+    if (elapsed >= periodTicks || periodTicks - elapsed < 8)
+    {
+        OCR3C = now + periodTicks;
+    }
+    else
+    {
+        OCR3C += periodTicks;
+    }
+    bool busy = updating;
+    updating = true;
+    sei();
+
+    // If an update took longer than the period, skip this one instead of
+    // running two at once.
+    if (busy) { return; }
+
+    int16_t speedLeft = Encoders::getSpeedLeft();
+    int16_t speedRight = Encoders::getSpeedRight();
+    if (Motors::isEmergencyStopped())
+    {
+        // Don't wind up the integrals against motors that are held stopped.
+        SpeedControllerMath::hold(controlLeft, speedLeft);
+        SpeedControllerMath::hold(controlRight, speedRight);
+    }
+    else
+    {
+        int16_t left = control(controlLeft, speedLeft);
+        int16_t right = control(controlRight, speedRight);
+        Motors::setSpeeds(left, right);
+    }
+
+    updating = false;
+}
+
+void SpeedController::start(uint16_t period)
+{
+    if (period > 30000) { period = 30000; }
+
+    Timer3Clock::init();
+    Motors::begin();
+    stop();
+
+    // Get the speed estimates started so the first update has a baseline.
+    Encoders::getSpeedLeft();
+    Encoders::getSpeedRight();
+
+    cli();
+    periodTicks = period * Timer3Clock::ticksPerMicrosecond;
+    controlLeft = WheelControl();
+    controlRight = WheelControl();
+    OCR3C = TCNT3 + periodTicks;
+    TIFR3 = (1 << OCF3C);  // Clear its interrupt flag by writing a 1.
+    TIMSK3 |= (1 << OCIE3C);
+    sei();
+}
+
+void SpeedController::stop()
+{
+    cli();
+    TIMSK3 &= ~(1 << OCIE3C);
+    sei();
+
+    Motors::setSpeeds(0, 0);
+}
+
+void SpeedController::setTargetSpeeds(int16_t leftSpeed, int16_t rightSpeed)
+{
+    cli();
+    controlLeft.target = leftSpeed;
+    controlRight.target = rightSpeed;
+    sei();
+}
+
+void SpeedController::setGains(int16_t newKp, int16_t newKi)
+{
+    cli();
+    kp = newKp;
+    ki = newKi;
+    controlLeft.integral = 0;
+    controlRight.integral = 0;
+    sei();
+}
+
+int16_t SpeedController::getSpeedLeft()
+{
+    cli();
+    int16_t speed = controlLeft.speed;
+    sei();
+    return speed;
+}
+
+int16_t SpeedController::getSpeedRight()
+{
+    cli();
+    int16_t speed = controlRight.speed;
+    sei();
+    return speed;
+}
+
+uint8_t SpeedController::getSaturation()
+{
+    cli();
+    uint8_t saturation = controlLeft.saturated | (controlRight.saturated << 1);
+    sei();
+    return saturation;
+}
+
+}
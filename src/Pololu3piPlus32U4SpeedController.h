@@ -0,0 +1,120 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4SpeedController.h
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \brief Controls the speeds of both wheels in the background using the
+/// encoders.
+///
+/// Motors::setSpeeds() sets the PWM duty cycle of the motors, so the speed
+/// the robot actually goes depends on its battery voltage, its load, and
+/// which edition of the 3pi+ it is. This class instead runs a
+/// proportional-integral (PI) control loop for each wheel in a timer
+/// interrupt, measuring the wheel speeds with Encoders::getSpeedLeft() and
+/// Encoders::getSpeedRight() and adjusting the motor speeds to keep them at
+/// the target speeds you set in encoder counts per second.
+///
+/// The control loop runs from a Timer 3 compare interrupt (see Timer3Clock).
+/// Interrupts are enabled while it runs, so it does not delay the encoder
+/// interrupts. While the controller is running, your code should not call
+/// Motors::setSpeeds() or the Encoders speed functions; use
+/// getSpeedLeft() and getSpeedRight() from this class instead.
+///
+/// All of the math is done with integers. The output of the controller for
+/// each wheel, in the units of Motors::setSpeeds(), is:
+///
+/// \f[
+/// \text{output} = \frac{k_p \, e + \sum k_i \, e}{2^{10}}
+/// \f]
+///
+/// where \f$e\f$ is the target speed minus the measured speed and the sum
+/// runs over all the updates so far. The sum is limited so that it cannot
+/// drive the output past full speed by itself, and it stops growing while
+/// the output is saturated in the direction of the error, so the controller
+/// recovers quickly after a wheel is stalled (anti-windup). Full speed is
+/// Motors::getMaxSpeed(), read on every update, so the loop follows changes
+/// made with Motors::setPwmConfiguration() (though you might want to scale
+/// the gains along with it).
+///
+/// While the motors are stopped by Motors::emergencyStop(), the loop keeps
+/// measuring the speeds but does not integrate the errors; the integral
+/// terms are cleared, so when Motors::clearEmergencyStop() is called the
+/// loop starts again from the proportional term instead of driving full
+/// power into whatever caused the stop.
+///
+/// Example usage:
+/// ~~~{.cpp}
+/// SpeedController::start();
+/// SpeedController::setTargetSpeeds(1000, 1000);
+/// ~~~
+class SpeedController
+{
+public:
+
+    /// Default time between control loop updates, in microseconds.
+    static const uint16_t defaultPeriod = 2000;
+
+    /// Default proportional gain.
+    static const int16_t defaultKp = 100;
+
+    /// Default integral gain.
+    static const int16_t defaultKi = 8;
+
+    /// The number of fraction bits in the gains.
+    static const uint8_t gainShift = 10;
+
+    /// \brief Starts the control loop.
+    ///
+    /// \param period The time between control loop updates, in
+    /// microseconds. The default is 2000, and the maximum is 30000.
+    ///
+    /// The target speeds start at zero.
+    static void start(uint16_t period = defaultPeriod);
+
+    /// \brief Stops the control loop and the motors.
+    static void stop();
+
+    /// \brief Sets the target speeds of both wheels.
+    ///
+    /// \param leftSpeed The target speed of the left wheel, in encoder counts
+    /// per second.
+    /// \param rightSpeed The target speed of the right wheel, in encoder counts
+    /// per second.
+    static void setTargetSpeeds(int16_t leftSpeed, int16_t rightSpeed);
+
+    /// \brief Sets the gains of the control loop.
+    ///
+    /// \param kp The proportional gain, with #gainShift fraction bits. The
+    /// default is #defaultKp.
+    /// \param ki The integral gain, with #gainShift fraction bits. The default
+    /// is #defaultKi.
+    ///
+    /// The integral gain is applied once per update, so if you change the
+    /// period you should change \p ki in proportion to keep the same
+    /// behavior. The integral terms are reset when the gains change.
+    static void setGains(int16_t kp, int16_t ki);
+
+    /// \brief Returns the speed of the left wheel measured by the most recent
+    /// update, in encoder counts per second.
+    static int16_t getSpeedLeft();
+
+    /// \brief Returns the speed of the right wheel measured by the most recent
+    /// update, in encoder counts per second.
+    static int16_t getSpeedRight();
+
+    /// \brief Returns which outputs were saturated in the most recent update.
+    ///
+    /// \return A bit field with bit 0 set if the left motor output was at full
+    /// speed, and bit 1 set if the right motor output was. If a bit stays set,
+    /// the target speed for that wheel cannot be reached, for example because
+    /// it is faster than the motor can go or because the wheel is stalled.
+    static uint8_t getSaturation();
+};
+
+}
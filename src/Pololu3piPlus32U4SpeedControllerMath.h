@@ -0,0 +1,86 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4SpeedControllerMath.h
+///
+/// \brief Integer math used by SpeedController.
+///
+/// These functions do not access any hardware, so they can also be compiled
+/// and checked on a PC by the tests in the `extras/test` folder.
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \brief The PI control loop behind SpeedController.
+class SpeedControllerMath
+{
+public:
+
+    /// The number of fraction bits in the gains and the integral.
+    static const uint8_t gainShift = 10;
+
+    /// State of the PI loop for one wheel.
+    struct WheelControl
+    {
+        int16_t target;    ///< the target speed
+        int16_t speed;     ///< the speed measured by the last update
+        int32_t integral;  ///< the integral term, with #gainShift fraction bits
+        bool saturated;    ///< true if the last output was at full speed
+    };
+
+    /// \brief Runs one step of the PI loop and returns the output.
+    ///
+    /// \param speed The measured speed.
+    /// \param kp The proportional gain, with #gainShift fraction bits.
+    /// \param ki The integral gain, with #gainShift fraction bits.
+    /// \param maxOutput The largest output, in the units of
+    /// Motors::setSpeeds().
+    static int16_t control(WheelControl & c, int16_t speed,
+        int16_t kp, int16_t ki, int16_t maxOutput)
+    {
+        c.speed = speed;
+        int16_t error = c.target - speed;
+
+        const int32_t maxIntegral = (int32_t)maxOutput << gainShift;
+        int32_t p = (int32_t)kp * error;
+        int32_t output = (p + c.integral) >> gainShift;
+
+        // Only integrate when that would not push a saturated output further
+        // (conditional integration), so the integral does not wind up.
+        bool saturatedHigh = output >= maxOutput;
+        bool saturatedLow = output <= -maxOutput;
+        if (!(saturatedHigh && error > 0) && !(saturatedLow && error < 0))
+        {
+            c.integral += (int32_t)ki * error;
+            if (c.integral > maxIntegral) { c.integral = maxIntegral; }
+            if (c.integral < -maxIntegral) { c.integral = -maxIntegral; }
+            output = (p + c.integral) >> gainShift;
+        }
+
+        c.saturated = false;
+        if (output >= maxOutput) { output = maxOutput; c.saturated = true; }
+        if (output <= -maxOutput) { output = -maxOutput; c.saturated = true; }
+        return output;
+    }
+
+    /// \brief Updates the state for an update in which the motor is held
+    /// stopped, for example by Motors::emergencyStop().
+    ///
+    /// \param speed The measured speed.
+    ///
+    /// The error says nothing about the output while the motor is held, so
+    /// instead of integrating it, this clears the integral. When the motor
+    /// is released, the loop starts again from the proportional term alone
+    /// instead of driving full power into whatever stopped it.
+    static void hold(WheelControl & c, int16_t speed)
+    {
+        c.speed = speed;
+        c.integral = 0;
+        c.saturated = false;
+    }
+};
+
+}
@@ -0,0 +1,29 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+#include <Pololu3piPlus32U4Timer3Clock.h>
+
+namespace Pololu3piPlus32U4
+{
+
+bool Timer3Clock::initialized = false;
+
+void Timer3Clock::init2()
+{
+    uint8_t sreg = SREG;
+    cli();
+
+    // Timer 3 configuration
+    // prescaler: clockI/O / 8
+    // outputs disabled
+    // normal mode (counts from 0 to 0xFFFF and overflows)
+    //
+    // Tick frequency calculation
+    // 16MHz / 8 (prescaler) = 2 MHz
+    TCCR3A = 0;
+    TCCR3B = (1 << CS31);
+    TIMSK3 = 0;
+
+    SREG = sreg;
+}
+
+}
@@ -0,0 +1,90 @@
+// Copyright (C) Pololu Corporation.  See www.pololu.com for details.
+
+/// \file Pololu3piPlus32U4Timer3Clock.h
+
+#pragma once
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+namespace Pololu3piPlus32U4
+{
+
+/// \brief Runs Timer 3 as a free-running clock for timestamps and background
+/// tasks.
+///
+/// Timer 3 is configured in normal mode with a prescaler of 8, so it counts
+/// up at 2 MHz (0.5 &micro;s per tick) and overflows every 32.768 ms. The
+/// library uses the three output compare channels of Timer 3 to schedule
+/// short interrupts for work that happens in the background, so this class
+/// will conflict with any other libraries using that timer (including the
+/// Arduino `analogWrite()` function on pin 5).
+///
+/// In particular, the Arduino `tone()` function uses Timer 3 on the
+/// ATmega32U4, so it cannot be used together with the features that need
+/// this class: LineSensors::startRead(), BumpSensors::startBackgroundSampling(),
+/// the Encoders speed functions, and SpeedController. A sketch that calls
+/// `tone()` as well as LineSensors::startRead() will not link, because both
+/// define the Timer 3 compare A interrupt. Use the Buzzer class, which uses
+/// Timer 4, to make sounds instead.
+///
+/// The blocking sensor reads (LineSensors::read(), BumpSensors::read(), and
+/// RCSensorArray) only use Timer 3 if it is already running, which gives
+/// them a resolution of 0.5 &micro;s. Otherwise they time the sensors with
+/// `micros()`, which has a resolution of 4 &micro;s, and leave Timer 3 alone,
+/// so sketches that use only those reads can still use `tone()` and
+/// `analogWrite()` on pin 5. To get the better resolution, call init() in
+/// `setup()`.
+///
+/// Each background feature's interrupt is in its own source file
+/// (LineSensors::startRead(), BumpSensors::startBackgroundSampling(), and
+/// SpeedController), and the library is linked as an archive, so a sketch
+/// only includes the interrupts for the features it uses.
+class Timer3Clock
+{
+public:
+    /// The number of timer ticks per microsecond.
+    static const uint8_t ticksPerMicrosecond = 2;
+
+    /// \brief Initializes Timer 3.
+    ///
+    /// This function configures Timer 3 if it has not been configured
+    /// already.  It is called automatically by the library features that
+    /// need the timer.  You only need to call it yourself if you want the
+    /// blocking sensor reads to be timed with it (see isRunning()).
+    static void init()
+    {
+        if (!initialized)
+        {
+            initialized = true;
+            init2();
+        }
+    }
+
+    /// \brief Returns true if init() has been called.
+    ///
+    /// The blocking sensor reads use Timer 3 for timing if this is true,
+    /// and `micros()` otherwise.
+    static bool isRunning() { return initialized; }
+
+    /// \brief Returns the current value of the timer counter.
+    ///
+    /// The 16-bit counter register is read with interrupts disabled, since
+    /// an interrupt that accesses Timer 3 in the middle of the read could
+    /// corrupt the result.
+    static inline uint16_t ticks()
+    {
+        uint8_t sreg = SREG;
+        cli();
+        uint16_t t = TCNT3;
+        SREG = sreg;
+        return t;
+    }
+
+private:
+    static void init2();
+    static bool initialized;
+};
+
+}